@@ -13,6 +13,7 @@
 #include <avr/pgmspace.h>
 #include <avr/interrupt.h>
 #include <stdlib.h> 
+#include <string.h>
 #include <math.h> 
 #include <util/delay.h>  
 #include <avr/sleep.h>
@@ -29,29 +30,452 @@
 // video timing
 #define LINE_TIME 1018 // 20 MHz 1271
 #define SLEEP_TIME 999 // 20 MHz 1250
-#define bytes_per_line 20
+#define frame_cycles ((uint32_t)262 * (LINE_TIME+1))
+
+//video geometry, set at compile time (e.g. -DVIDEO_WIDTH=320)
+//up to 160 pixels the USART runs at fosc/4 (32 cycles a byte),
+//wider up to 320 at fosc/2 (UBRR0 = 0, 16 cycles a byte)
+//VIDEO_HEIGHT is 176..216 lines, centred on lines 30..229
+#ifndef VIDEO_WIDTH
+#define VIDEO_WIDTH 160
+#endif
+#ifndef VIDEO_HEIGHT
+#define VIDEO_HEIGHT 200
+#endif
+
+//define to scan every framebuffer row out on two lines
+//half the logical rows in half the RAM, e.g. 160x100 in 2000 bytes
+//#define LINE_DOUBLE
+
+#ifdef LINE_DOUBLE
+#define line_shift 1
+#else
+#define line_shift 0
+#endif
+
+//screen_height is logical rows, scan_lines the lines they cover
+#define bytes_per_line (VIDEO_WIDTH/8)
 #define screen_width (bytes_per_line*8)
-#define screen_height 200
+#define scan_lines VIDEO_HEIGHT
+#define screen_height (scan_lines >> line_shift)
 #define screen_array_size screen_width*screen_height/8 
 
-#define ScreenTop 30
-#define ScreenBot (ScreenTop+screen_height)
+#define ScreenTop (30 + (200 - scan_lines)/2)
+#define ScreenBot (ScreenTop+scan_lines)
+
+#if bytes_per_line <= 20
+#define video_ubrr 1
+#else
+#define video_ubrr 0
+#endif
+#define scan_cycles (16*(video_ubrr+1))	//cycles per byte out of UDR0
+
+//line budget: sync and ISR entry before the first byte, the
+//scanout, then two acq_sample calls, the next line's setup and the
+//epilogue, all before the CPU sleeps
+//the tail is an estimate (about 70 per acq_sample, 40 setup, 40
+//epilogue), check it with PROFILE: L must stay under SLEEP_TIME
+#define scan_start_cycles 130
+#define scan_tail_cycles 220
+
+//136 keeps the duty readout (DutyX) on screen and covers the
+//fft_n samples of the spectrum
+#if VIDEO_WIDTH % 8 || bytes_per_line < 17
+#error "VIDEO_WIDTH must be a multiple of 8 and at least 136"
+#endif
+#if scan_start_cycles + bytes_per_line*scan_cycles + scan_tail_cycles > SLEEP_TIME
+#error "VIDEO_WIDTH does not fit in a line"
+#endif
+#if scan_lines < 176 || scan_lines > 216 || scan_lines % (1 << line_shift)
+#error "VIDEO_HEIGHT must be 176..216 (and even with LINE_DOUBLE)"
+#endif
+
+//x coordinates need 16 bits past 256 pixels
+#if screen_width > 256
+typedef uint16_t xcoord;
+#else
+typedef uint8_t xcoord;
+#endif
+
+//define to draw into a back page while the ISR scans the front page,
+//the pages are swapped during vertical blanking
+//costs a second screen_array_size of RAM
+//#define DOUBLE_BUFFER
+
+#ifdef DOUBLE_BUFFER
+#define screen_pages 2
+#else
+#define screen_pages 1
+#endif
+
+//trace placement: sample>>trace_shift lands on rows
+//trace_top..trace_top+trace_height-1
+//(the offset keeps the horizontal line off the border)
+#define trace_shift (1 + line_shift)
+#define trace_height (256 >> trace_shift)
+#ifdef LINE_DOUBLE
+#define trace_top 12
+#else
+#define trace_top 16
+#endif
+
+//samples per displayed trace, one per column at 16 a division
+//(the pre-trigger ring holds 256, so wide screens stop at 240)
+#define trace_length (screen_width < 240 ? screen_width : 240)
+
+//RAM: the 16K less a stack reserve, the globals too small to list,
+//the buffers that scale with the geometry and the frame pages;
+//what is left is capture_ram for the deep record
+//buffers: three 256-sample rings, fft_re/fft_im, xy_x/xy_y, per
+//column adc_buffer, adc_min_buffer, adc_buffer_b, avg_acc (2) and
+//trace_lo/trace_hi (2 channels on each page), grat_row per line
+#define ram_size 16384
+#define ram_stack 512	//ISR frames and main's locals
+#define ram_misc 1024	//scalars, tables kept in RAM, string literals
+#define fft_n 128	//spectrum points
+#define xy_history 512	//XY points kept on screen
+#define ram_buffers (3*256 + 4*fft_n + 2*xy_history \
+	+ trace_length*(5 + 4*screen_pages) + 3*bytes_per_line)
+#define capture_ram (ram_size - ram_stack - ram_misc - ram_buffers \
+	- screen_pages*screen_array_size)
+#if capture_ram < 0
+#error "frame buffer pages do not fit in RAM"
+#endif
+
+//define to measure the raster ISR and the frame budget and show the
+//numbers under the trace (see task_prof)
+//#define PROFILE
+
+//define to send the displayed page out of USART1 when a host asks
+//for it (see task_shot, host/shot.c decodes it)
+#define SCREENSHOT
+#define shot_baud 115200
+#define shot_ubrr ((F_CPU/8 + shot_baud/2) / shot_baud - 1)	//2.1% fast at 16 MHz
+
+//define to OR a graticule into the picture as each line is scanned out
+//the drawing pages never hold the grid, so traces can XOR freely
+#define GRATICULE
+
+#define grat_div 16	//pixels per division
+#define grat_vdiv (grat_div >> line_shift)	//rows per division
+
+#ifdef GRATICULE
+//one line of overlay: 0 blank, 1 dots on the division columns,
+//2 dotted division line
+char grat_row[3][bytes_per_line];
+char *grat_next;	//overlay row for the next scan line
+#define scan_byte() (*scan++ | *ov++)
+
+//overlay row for screen row y: dotted division lines every grat_vdiv
+//rows (and the bottom edge), dotted verticals every 4th line between
+static inline char *grat_line(uint8_t y) {
+	uint8_t r = y - trace_top;
+
+	if (r >= trace_height) return grat_row[0];
+	if ((r & (grat_vdiv-1)) == 0 || r == trace_height-1) return grat_row[2];
+	if ((r & (3 >> line_shift)) == 0) return grat_row[1];
+	return grat_row[0];
+}
+
+//10 x 8 divisions over the trace area
+void grat_init(void) {
+	uint8_t i;
+
+	memset(grat_row, 0, sizeof(grat_row));
+	for (i = 0; i < trace_length/8; i += grat_div/8)
+		grat_row[1][i] = 0x80;
+	memset(grat_row[2], 0x88, trace_length/8);
+	grat_next = grat_row[0];
+}
+#else
+#define scan_byte() (*scan++)
+#endif
+//roll mode scrolls by starting the trace rows at roll_byte and
+//wrapping at the end of the row, which needs the trace to span the
+//whole line and the room of 32-cycle bytes; otherwise roll mode
+//sweeps a pen across a still picture instead
+#if trace_length == screen_width && video_ubrr == 1
+#define ROLL_SCROLL
+#endif
+
+#ifdef ROLL_SCROLL
+#define scan_wrap() if (scan == we) scan = ws
+#else
+#define scan_wrap()
+#endif
+
+//visible-line emitter
+//MSPIM takes scan_cycles per byte, so after the two bytes that fill
+//UDR0 and its buffer, every byte is stored exactly scan_cycles after
+//the one before, with no UDRE polling
+//the store lands mid-window, scan_margin after UDRE0 would have set
+//the cycles between stores are fixed slots; the ADC latch is split
+//over two slots (scan_adc1/2_cycles) before bytes 2,3 and the last
+//three, the rest is padding (scan_free_cycles per line)
+//code moved into a slot must take the same cycles out of its pad
+#define scan_margin (scan_cycles/2)
+#define scan_adc1_cycles 9
+#define scan_adc2_cycles 8
+#ifdef GRATICULE
+#define scan_emit_cycles (7 + scan_wrap_cycles)
+#else
+#define scan_emit_cycles (4 + scan_wrap_cycles)
+#endif
+#ifdef ROLL_SCROLL
+#define scan_wrap_cycles 4
+#else
+#define scan_wrap_cycles 0
+#endif
+#define scan_pad (scan_cycles - scan_emit_cycles)
+#define scan_pad_a (scan_cycles + scan_margin - 2*scan_emit_cycles - scan_adc1_cycles)
+#define scan_pad_1 (scan_pad - scan_adc1_cycles)
+#define scan_pad_2 (scan_pad - scan_adc2_cycles)
+#define scan_free_cycles (scan_pad_a + 2*scan_pad_2 + scan_pad_1 + (bytes_per_line-6)*scan_pad)
+
+#if scan_pad_a < 0 || scan_pad_1 < 0
+#error "ADC latch does not fit between two bytes"
+#endif
+
+#ifdef __AVR__
+//n cycles of padding, 2 per rjmp
+asm(".macro scan_wait n\n"
+	".rept (\\n)/2\n rjmp .+0\n .endr\n"
+	".if (\\n)&1\n nop\n .endif\n"
+	".endm\n");
+
+//X back to the row start when it reaches the row end,
+//4 cycles whether or not the branch is taken
+#ifdef ROLL_SCROLL
+#define SCAN_WRAP "cp r26, %A[we]\n\t cpc r27, %B[we]\n\t brne 1f\n\t movw r26, %[ws]\n1:\n\t"
+#else
+#define SCAN_WRAP
+#endif
+
+//one byte from X (ORed with the overlay from Z) into UDR0
+#ifdef GRATICULE
+#define SCAN_EMIT "ld %[t0], X+\n\t ld %[t1], Z+\n\t or %[t0], %[t1]\n\t sts %[udr], %[t0]\n\t" SCAN_WRAP
+#else
+#define SCAN_EMIT "ld %[t0], X+\n\t sts %[udr], %[t0]\n\t" SCAN_WRAP
+#endif
+
+//latch ADCH and the input it came from, switch inputs when dual
+//(adc_chan ^= acq_dual, branch free) and start the next conversion
+//first half leaves the new channel in t2 for the second
+#define SCAN_ADC1(s, c) \
+	"lds " s ", %[adch]\n\t" \
+	"lds " c ", %[chan]\n\t" \
+	"lds %[t2], %[dual]\n\t" \
+	"eor %[t2], " c "\n\t" \
+	"sts %[chan], %[t2]\n\t"
+#define SCAN_ADC2 \
+	"ori %[t2], %[admux]\n\t" \
+	"sts %[mux], %[t2]\n\t" \
+	"lds %[t2], %[adcsra]\n\t" \
+	"ori %[t2], %[adsc]\n\t" \
+	"sts %[adcsra], %[t2]\n\t"
+#endif
 
 //sync
 char syncON, syncOFF;
 
 volatile uint8_t  adc_index;
-uint8_t adc_buffer[160];
-uint8_t adc_erase[160];
+uint8_t adc_buffer[trace_length];
+uint8_t adc_min_buffer[trace_length];	//column minimum, equals adc_buffer unless peak detecting
 uint8_t adc_complete;
 uint8_t draw_complete;
+uint8_t running;	//RUN/STOP
+
+//pre-trigger ring buffer
+//256 entries so the uint8_t adc_index wraps for free
+uint8_t adc_ring[256];
+uint8_t adc_ring_min[256];	//peak detect: minimum of each committed sample
+
+//dual channel: ADC0 and ADC1 alternate conversion by conversion,
+//a committed sample is a pair, ADC1 lands at the same ring index
+uint8_t acq_dual;
+volatile uint8_t adc_chan;	//input of the conversion in progress
+uint8_t chan_a;	//ADC0 half of the pair being built
+uint8_t adc_ring_b[256];
+uint8_t adc_buffer_b[trace_length];
+#define adc_admux ((1<<ADLAR) | (1<<REFS0))	//high byte, Vref = Vcc
+uint8_t adc_start;	//ring index of the first displayed sample
+
+//deep memory: ADC0 also goes to a record of trace_length << deep_zmax
+//samples, as long as capture_ram allows, and the trace is a zoomed
+//and panned view of it
+#if (trace_length << 6) <= capture_ram
+#define deep_zmax 6
+#elif (trace_length << 5) <= capture_ram
+#define deep_zmax 5
+#elif (trace_length << 4) <= capture_ram
+#define deep_zmax 4
+#elif (trace_length << 3) <= capture_ram
+#define deep_zmax 3
+#elif (trace_length << 2) <= capture_ram
+#define deep_zmax 2
+#else
+#error "no room for a deep record of four screens, reduce the geometry"
+#endif
+#define deep_length (trace_length << deep_zmax)
+uint8_t acq_deep;
+uint8_t deep_ring[deep_length];	//a ring, deep_length is not a power of 2
+uint16_t deep_index;	//next write
+uint16_t deep_start;	//first sample of the last record
+uint8_t deep_zoom;	//1 << deep_zoom samples per column
+uint16_t deep_pan;	//samples from the record start to the view
+uint8_t deep_redraw;	//zoom or pan changed on a held record
+
+//roll mode: no trigger, main draws each committed sample as the next
+//column of a circular trace, and the scanout rotates to match
+uint8_t acq_roll;
+uint8_t roll_read;	//next ring index to draw
+uint8_t roll_col;	//trace column the next sample goes to
+uint8_t roll_last[2];	//row of each channel's last sample, 255 for none
+
+//trigger modes
+#define TrigAuto 0
+#define TrigNormal 1
+#define TrigSingle 2
+//trigger slopes
+#define TrigRising 0
+#define TrigFalling 1
+//trigger engine states
+#define TrigFill 0	//collecting pre-trigger samples
+#define TrigArmed 1	//waiting for the signal to leave the hysteresis band
+#define TrigReady 2	//waiting for the edge through the trigger level
+#define TrigPost 3	//collecting post-trigger samples
+#define TrigRoll 4	//roll mode: samples flow with no trigger
+#define TrigDone 5	//capture complete, waiting for main to copy it out
+#define TrigHold 6	//single shot captured, waiting for a re-arm
+
+uint8_t trig_mode, trig_slope, trig_level, trig_hyst;
+uint8_t trig_pretrig;	//samples shown left of the trigger point
+uint16_t trig_timeout;	//auto mode: samples to wait before a forced trigger
+volatile uint8_t trig_state;
+uint16_t trig_count;	//samples left in TrigFill or TrigPost
+uint16_t trig_wait;	//samples left before an auto trigger
+uint8_t trig_invert;	//0xff for falling edges, so the ISR only tests rising
+uint8_t trig_lo, trig_hi;	//arm below trig_lo, fire at or above trig_hi
+uint8_t trig_forced;	//last capture was auto-triggered
+
+//crossing measurements, counted by the ISR as samples are committed
+//and copied to meas_last when a capture is collected
+//8 and 16-bit only, the ISR has no time for wider arithmetic
+struct meas {
+	uint16_t n;	//samples, counting stops at 0xffff
+	uint8_t high;	//above the trigger level (with hysteresis)
+	uint16_t edges;	//rising crossings of the trigger level
+	uint16_t first, last;	//sample number of the first and last crossing
+	uint16_t high_n;	//high samples since the first crossing
+	uint16_t high_last;	//high_n at the last crossing
+};
+//two banks, so roll mode can take one while the ISR counts into
+//the other (meas_acc is the one being counted)
+struct meas meas_bank[2], meas_last;
+volatile uint8_t meas_cur;
+#define meas_acc meas_bank[meas_cur]
+uint8_t meas_lo, meas_hi;	//crossing thresholds, not inverted for falling edges
+
+//level measurements, summed in main from the collected samples
+struct level {
+	uint8_t min, max;
+	uint32_t sum, sumsq;
+	uint16_t n;
+};
+struct level level_last;
+struct level roll_level;	//roll mode: ADC0 over the sweep so far
+
+//acquisition sources
+#define AcqLine 0	//two samples per scanline from the raster ISR
+#define AcqBurst 1	//timer 0 triggered ADC with video stopped
+uint8_t acq_source;
+uint8_t acq_ocr;	//burst: OCR0A, sample period is (acq_ocr+1) timer 0 ticks
+uint8_t acq_clock;	//burst: TCCR0B clock select
+uint8_t acq_adps;	//burst: ADC prescaler bits
+uint32_t acq_period2;	//twice the CPU cycles between committed samples
+uint16_t acq_decimate;	//commit one sample in this many
+uint16_t acq_skip;	//samples left before the next commit
+
+//acquisition modes
+#define AcqNormal 0	//commit every acq_decimate-th sample
+#define AcqPeak 1	//commit the min and max of each acq_decimate samples
+#define AcqBoxcar 2	//normal captures, shown as the mean of each 2^avg_shift
+#define AcqExp 3	//normal captures, exponential average with weight 2^-avg_shift
+uint8_t acq_mode;
+uint8_t peak_min, peak_max;	//running extremes since the last commit
+
+//averaging, done in main() on each collected capture
+//boxcar: sum of avg_count captures; exponential: the average << avg_shift
+//255 << 8 still fits in 16 bits
+uint16_t avg_acc[trace_length];
+uint8_t avg_shift;	//1..8, N = 2^avg_shift
+uint16_t avg_count;	//captures summed, 0 means start over
+
+//timebases, 16 samples per division
+//raster samples are 509 cycles apart on average (two per LINE_TIME),
+//slower settings keep one in acq_decimate of them
+struct timebase {
+	char name[6];	//status line label, 5 small-font characters
+	uint8_t source;
+	uint8_t ocr, clock, adps;	//AcqBurst settings
+	uint16_t decimate;	//AcqLine decimation
+};
+
+struct timebase timebases[] = {
+	//ADC_vect must finish inside the period, PROFILE shows its worst
+	//case (A) and the 108-cycle conversion at prescaler 8 is the floor
+	{"200US", AcqBurst, 199, _BV(CS00), 3, 1},
+	{"500US", AcqLine, 0, 0, 0, 1},
+	{"1MS  ", AcqLine, 0, 0, 0, 2},
+	{"2MS  ", AcqLine, 0, 0, 0, 4},
+	{"5MS  ", AcqLine, 0, 0, 0, 10},
+	{"10MS ", AcqLine, 0, 0, 0, 20},
+	{"20MS ", AcqLine, 0, 0, 0, 40},
+	{"50MS ", AcqLine, 0, 0, 0, 100},
+	{"100MS", AcqLine, 0, 0, 0, 200},
+	{"200MS", AcqLine, 0, 0, 0, 400},
+	{"500MS", AcqLine, 0, 0, 0, 1000},
+	{"1S   ", AcqLine, 0, 0, 0, 2000},
+	{"2S   ", AcqLine, 0, 0, 0, 4000},
+	{"5S   ", AcqLine, 0, 0, 0, 10000}
+};
+#define timebase_count (sizeof(timebases)/sizeof(timebases[0]))
+//timer 0 prescale for each TCCR0B clock select
+uint16_t timer0_prescale[6] = {0, 1, 8, 64, 256, 1024};
+uint8_t timebase;
 
 
 //current line number in the current frame
 volatile int LineCount;
-
-//160h x 160v - screen buffer and pointer
-char screen[screen_array_size];
+volatile uint8_t frame_count;	//bumped at ScreenBot, for the scheduler
+
+#ifdef PROFILE
+//worst TCNT1 at raster ISR exit on visible and blank lines
+//(cycles into the line, less the register pops of the epilogue)
+volatile uint16_t prof_line_max, prof_blank_max;
+volatile uint32_t prof_isr_cycles;	//running sum of the above
+uint16_t prof_collects;	//captures collected
+uint16_t prof_dropped;	//frames a finished capture waited out
+uint32_t prof_idle;	//cycles main slept this frame
+//worst TCNT0 at ADC_vect exit in a burst, 255 for an overrun
+volatile uint8_t prof_burst_max;
+#endif
+
+//160h x 200v - screen pages and pointers
+//screen is the page being drawn, scan_screen the one being sent out
+char screen_page[screen_pages][screen_array_size];
+uint8_t draw_page;
+//trace rows drawn in each column of each page and channel,
+//lo > hi when empty
+uint8_t trace_lo[screen_pages][2][trace_length];
+uint8_t trace_hi[screen_pages][2][trace_length];
+signed char trace_pos[2];	//vertical offset of each channel in rows
+char *screen;
+char *scan_screen;
+volatile uint8_t flip_pending;
+//the next visible line: start of its row and first byte sent
+char *scan_row, *scan_next;
+uint8_t roll_byte;	//trace rows start this many bytes in
 int* screenindex;
 
 //One bit masks
@@ -61,7 +485,7 @@ char pos[8] = {0x80,0x40,0x20,0x10,0x08,0x04,0x02,0x01};
 //3x5 font numbers, then letters
 //packed two per definition for fast 
 //copy to the screen at x-position divisible by 4
-prog_char smallbitmap[39][5] = { 
+prog_char smallbitmap[43][5] = { 
 	//0
     0b11101110,
 	0b10101010,
@@ -295,7 +719,31 @@ prog_char smallbitmap[39][5] = {
 	0b00100010,
 	0b01000100,
 	0b10001000,
-	0b11101110
+	0b11101110,
+	//.
+	0b00000000,
+	0b00000000,
+	0b00000000,
+	0b00000000,
+	0b01000100,
+	//%
+	0b10101010,
+	0b00100010,
+	0b01000100,
+	0b10001000,
+	0b10101010,
+	//-
+	0b00000000,
+	0b00000000,
+	0b11101110,
+	0b00000000,
+	0b00000000,
+	//+
+	0b00000000,
+	0b01000100,
+	0b11101110,
+	0b01000100,
+	0b00000000
 };
 
 //===============================================
@@ -1330,25 +1778,501 @@ prog_char ascii[128][7] = {
 	0b00000000
 };
 
-// put the MCU to sleep JUST before the CompA ISR goes off
-ISR(TIMER1_COMPB_vect, ISR_NAKED)
-{
-	sei();
-	sleep_cpu();
-	reti();
+//==================================
+//start the measurements over
+//start high so the first crossing counted is a real one
+static inline void meas_reset(struct meas *m) {
+	memset(m, 0, sizeof(*m));
+	m->high = 1;
 }
 
+static inline void level_reset(struct level *l) {
+	memset(l, 0, sizeof(*l));
+	l->min = 255;
+}
+
+static inline void level_add(struct level *l, uint8_t s) {
+	if (s < l->min) l->min = s;
+	if (s > l->max) l->max = s;
+	l->sum += s;
+	l->sumsq += (uint16_t)s * s;
+	l->n++;
+}
 
 //==================================
-//This is the sync generator and raster generator. It MUST be entered from 
-//sleep mode to get accurate timing of the sync pulses
+//trigger engine
+//(re)start a capture with the current trigger settings
+//call only while the ISR is not using the trigger state
+//(TrigDone, TrigHold, or before sei())
+void trig_arm(void) {
+	uint8_t level;
+
+	if (trig_slope == TrigFalling) {
+		trig_invert = 0xff;
+		level = 255 - trig_level;
+	}
+	else {
+		trig_invert = 0;
+		level = trig_level;
+	}
+	trig_hi = level;
+	trig_lo = (level > trig_hyst) ? level - trig_hyst : 0;
+	meas_hi = trig_level;
+	meas_lo = (trig_level > trig_hyst) ? trig_level - trig_hyst : 0;
+
+	meas_reset(&meas_acc);
+
+	trig_wait = trig_timeout;
+	trig_forced = 0;
+	//deep records keep the trigger at the same fraction of the record
+	trig_count = acq_deep ? (uint16_t)trig_pretrig << deep_zmax : trig_pretrig;
+	acq_skip = 1;
+	peak_min = 255;
+	peak_max = 0;
+	if (acq_roll) trig_state = TrigRoll;
+	else trig_state = (trig_pretrig) ? TrigFill : TrigArmed;
+}
 
-ISR (TIMER1_COMPA_vect) {
-	int x, screenStart0,screenStart1,screenStart2,screenStart3,screenStart4,screenStart5,screenStart6,screenStart7,screenStart8,screenStart9,screenStart10,screenStart11,screenStart12,screenStart13,screenStart14,screenStart15,screenStart16,screenStart17,screenStart18, screenStart19 ;
-	//start the Horizontal sync pulse    
-	PORTD = syncON;
+//mark the sample just stored as the trigger point
+static inline void trig_fire(void) {
+	uint16_t p;
 
-	//update the current scanline number
+	adc_start = adc_index - 1 - trig_pretrig;
+	if (acq_deep) {
+		p = (uint16_t)trig_pretrig << deep_zmax;
+		deep_start = deep_index + deep_length - 1 - p;
+		if (deep_start >= deep_length) deep_start -= deep_length;
+		trig_count = deep_length - 1 - p;
+	}
+	else trig_count = trace_length - 1 - trig_pretrig;
+	trig_state = TrigPost;
+}
+
+//count crossings of one committed sample
+static inline void meas_sample(uint8_t s) {
+	struct meas *m = &meas_bank[meas_cur];
+
+	if (m->n == 0xffff) return;
+
+	if (m->high) {
+		if (s < meas_lo) m->high = 0;
+		else if (m->edges) m->high_n++;
+	}
+	else if (s >= meas_hi) {
+		m->high = 1;
+		if (m->edges == 0) m->first = m->n;
+		m->last = m->n;
+		m->high_last = m->high_n;
+		m->high_n++;
+		m->edges++;
+	}
+	m->n++;
+}
+
+//store sample s in the ring and run the trigger state machine on t
+//runs in the raster ISR twice a line and in ADC_vect, so only 8 and
+//16-bit work here (see scan_tail_cycles and prof_burst_max)
+static inline void acq_commit(uint8_t s, uint8_t t) {
+	adc_ring[adc_index++] = s;
+	if (acq_deep) {
+		deep_ring[deep_index] = s;
+		if (++deep_index == deep_length) deep_index = 0;
+	}
+	meas_sample(s);
+	s = t ^ trig_invert;
+
+	switch (trig_state) {
+	case TrigFill:
+		if (--trig_count == 0) trig_state = TrigArmed;
+		break;
+	case TrigArmed:
+		if (s < trig_lo) trig_state = TrigReady;
+		else if (trig_mode == TrigAuto && --trig_wait == 0) {
+			trig_forced = 1;
+			trig_fire();
+		}
+		break;
+	case TrigReady:
+		if (s >= trig_hi) trig_fire();
+		else if (trig_mode == TrigAuto && --trig_wait == 0) {
+			trig_forced = 1;
+			trig_fire();
+		}
+		break;
+	case TrigPost:
+		if (--trig_count == 0) {
+			trig_state = TrigDone;
+			adc_complete = 1;
+		}
+		break;
+	}
+}
+
+//one raw ADC reading from input ch: decimate for the timebase, then commit
+//peak detect keeps the extremes of the skipped readings, and
+//triggers on the maximum for rising edges, the minimum for falling
+//In dual mode an ADC0 reading is only held until its ADC1 partner
+//arrives; ADC1 is stored as is and the pair goes on as one sample.
+static inline void acq_sample(uint8_t s, uint8_t ch) {
+	if (trig_state >= TrigDone) return;
+
+	if (acq_dual) {
+		if (ch == 0) {
+			chan_a = s;
+			return;
+		}
+		adc_ring_b[adc_index] = s;
+		s = chan_a;
+	}
+
+	if (acq_mode == AcqPeak) {
+		if (s < peak_min) peak_min = s;
+		if (s > peak_max) peak_max = s;
+		if (--acq_skip) return;
+
+		acq_skip = acq_decimate;
+		adc_ring_min[adc_index] = peak_min;
+		acq_commit(peak_max, trig_invert ? peak_min : peak_max);
+		peak_min = 255;
+		peak_max = 0;
+		return;
+	}
+
+	if (--acq_skip) return;
+
+	acq_skip = acq_decimate;
+	acq_commit(s, s);
+}
+
+//view of the deep record: trace_length columns of 1 << deep_zoom
+//samples from deep_pan on, each column the min and max of its samples
+//one pass over the ring, no divides
+void deep_view(void) {
+	uint16_t i = deep_start + deep_pan;
+	uint8_t j, k, v, lo, hi;
+
+	//the readouts follow the view, not the shallow ring
+	level_reset(&level_last);
+	if (i >= deep_length) i -= deep_length;
+	for (j = 0; j < trace_length; j++) {
+		lo = 255;
+		hi = 0;
+		k = 1 << deep_zoom;
+		do {
+			v = deep_ring[i];
+			if (++i == deep_length) i = 0;
+			level_add(&level_last, v);
+			if (v < lo) lo = v;
+			if (v > hi) hi = v;
+		} while (--k);
+		adc_buffer[j] = hi;
+		adc_min_buffer[j] = lo;
+	}
+}
+
+//copy a finished capture out of the ring, aligned to the trigger,
+//then re-arm (or hold, in single mode)
+//a deep record is also held once stopped, so it can be browsed
+void acq_collect(void) {
+	uint8_t j, i = adc_start;
+
+	level_reset(&level_last);
+	for (j = 0; j < trace_length; j++) {
+		adc_buffer[j] = adc_ring[i];
+		adc_min_buffer[j] = (acq_mode == AcqPeak) ? adc_ring_min[i] : adc_ring[i];
+		adc_buffer_b[j] = adc_ring_b[i];
+		level_add(&level_last, adc_ring[i]);
+		if (acq_mode == AcqPeak) level_add(&level_last, adc_ring_min[i]);
+		i++;
+	}
+	//the post-trigger part of a deep record has wrapped adc_ring,
+	//deep_view replaces level_last with the record's own
+	if (acq_deep) deep_view();
+	meas_last = meas_acc;
+#ifdef PROFILE
+	prof_collects++;
+#endif
+
+	adc_complete = 0;
+	if (trig_mode == TrigSingle || !running) trig_state = TrigHold;
+	else trig_arm();
+}
+
+//==================================
+//call after reading ADCH and before the next conversion starts:
+//in dual mode the next conversion is on the other input
+static inline void adc_switch(void) {
+	if (acq_dual) {
+		adc_chan ^= 1;
+		ADMUX = adc_admux | adc_chan;
+	}
+}
+
+//==================================
+//CPU cycles between two single-channel samples of timebase tb, times 2
+uint32_t timebase_period2(uint8_t tb) {
+	if (timebases[tb].source == AcqBurst)
+		return 2 * (uint32_t)(timebases[tb].ocr + 1) * timer0_prescale[timebases[tb].clock];
+	return (uint32_t)(LINE_TIME + 1) * timebases[tb].decimate;
+}
+
+void time_draw(void);
+
+//==================================
+//switch to timebase tb and restart the capture
+void timebase_set(uint8_t tb) {
+	//park the ISR before touching its settings
+	trig_state = TrigHold;
+	adc_complete = 0;
+
+	timebase = tb;
+	acq_source = timebases[tb].source;
+	acq_ocr = timebases[tb].ocr;
+	acq_clock = timebases[tb].clock;
+	acq_adps = timebases[tb].adps;
+	acq_decimate = timebases[tb].decimate;
+	avg_count = 0;
+
+	//a dual pair takes two raw samples: halve the decimation where
+	//possible to keep the time/div, the fastest settings run at half
+	//rate per channel instead
+	if (acq_dual && acq_decimate > 1) acq_decimate >>= 1;
+
+	if (acq_source == AcqBurst) acq_period2 = timebase_period2(tb);
+	else acq_period2 = (uint32_t)(LINE_TIME + 1) * acq_decimate;
+	if (acq_dual) acq_period2 <<= 1;
+
+	//roll mode draws once a frame out of the 256-sample ring, so it
+	//takes the first setting that leaves a quarter of it spare
+	if (acq_roll && tb < timebase_count-1 &&
+	    (acq_source == AcqBurst || acq_period2 < frame_cycles/96)) {
+		timebase_set(tb + 1);
+		return;
+	}
+
+	trig_arm();
+	time_draw();
+}
+
+//==================================
+//one or two channels, restarts the capture
+void acq_dual_set(uint8_t on) {
+	trig_state = TrigHold;
+	adc_complete = 0;
+	acq_dual = on;
+	//the deep record has no room for a second input
+	if (on) acq_deep = 0;
+	//the conversion in flight may be on either input, the
+	//pair order settles after the first reading
+	adc_chan = 0;
+	ADMUX = adc_admux;
+	timebase_set(timebase);
+}
+
+//inter-channel skew in CPU cycles: ADC1 is converted one raw
+//sample period after ADC0 (on average half a line for the raster)
+uint16_t acq_skew(void) {
+	if (acq_source == AcqBurst) return acq_period2 >> 2;
+	return (LINE_TIME + 1) >> 1;
+}
+
+//==================================
+//restart the capture after a trigger setting changed
+void trig_set(void) {
+	trig_state = TrigHold;
+	adc_complete = 0;
+	avg_count = 0;
+	trig_arm();
+}
+
+//==================================
+//switch acquisition mode and restart the capture
+//deep memory on or off, showing the whole record
+void acq_deep_set(uint8_t on) {
+	trig_state = TrigHold;
+	adc_complete = 0;
+	if (on && acq_dual) acq_dual_set(0);
+	acq_deep = on;
+	deep_index = 0;
+	deep_zoom = deep_zmax;
+	deep_pan = 0;
+	avg_count = 0;
+	trig_arm();
+}
+
+//zoom around the centre of the view, keeping it inside the record
+void deep_zoom_set(uint8_t z) {
+	uint16_t c = deep_pan + ((uint16_t)trace_length << deep_zoom >> 1);
+	uint16_t h = (uint16_t)trace_length << z >> 1;
+
+	deep_zoom = z;
+	deep_pan = (c > h) ? c - h : 0;
+	if (deep_pan > deep_length - ((uint16_t)trace_length << z))
+		deep_pan = deep_length - ((uint16_t)trace_length << z);
+}
+
+void acq_mode_set(uint8_t m) {
+	trig_state = TrigHold;
+	adc_complete = 0;
+	acq_mode = m;
+	avg_count = 0;
+	trig_arm();
+}
+
+//==================================
+//fold the capture in adc_buffer into the average
+//returns 1 when adc_buffer (and adc_min_buffer) hold a trace to draw
+//shifts and adds only, a few thousand cycles per capture
+uint8_t avg_update(void) {
+	uint8_t j;
+
+	if (acq_mode == AcqBoxcar) {
+		if (avg_count == 0) memset(avg_acc, 0, sizeof(avg_acc));
+		for (j = 0; j < trace_length; j++)
+			avg_acc[j] += adc_buffer[j];
+		if (++avg_count < (1 << avg_shift)) return 0;
+
+		for (j = 0; j < trace_length; j++)
+			adc_buffer[j] = avg_acc[j] >> avg_shift;
+		avg_count = 0;
+	}
+	else if (acq_mode == AcqExp) {
+		//acc += x - acc/N, seeded with the first capture
+		for (j = 0; j < trace_length; j++) {
+			if (avg_count == 0) avg_acc[j] = (uint16_t)adc_buffer[j] << avg_shift;
+			else avg_acc[j] += adc_buffer[j] - (avg_acc[j] >> avg_shift);
+			adc_buffer[j] = avg_acc[j] >> avg_shift;
+		}
+		avg_count = 1;
+	}
+	else return 1;
+
+	memcpy(adc_min_buffer, adc_buffer, trace_length);
+	return 1;
+}
+
+//=== spectrum ========================================================
+//128 point radix-2 decimation in time FFT on 16-bit data,
+//halving inside every butterfly so no stage can overflow
+#define fft_log2n 7	//of fft_n
+#if trace_length < fft_n
+#error "the spectrum needs fft_n samples across the trace"
+#endif
+#define fft_first ((trace_length-fft_n)/2)	//samples used, centred on the trigger
+int16_t fft_re[fft_n], fft_im[fft_n];
+
+//sin(2 pi k/128) in Q14 for k = 0..95, cos is 32 entries further on
+prog_int16_t fft_sin[fft_n/2+fft_n/4] = {
+	0, 804, 1606, 2404, 3196, 3981, 4756, 5520,
+	6270, 7005, 7723, 8423, 9102, 9760, 10394, 11003,
+	11585, 12140, 12665, 13160, 13623, 14053, 14449, 14811,
+	15137, 15426, 15679, 15893, 16069, 16207, 16305, 16364,
+	16384, 16364, 16305, 16207, 16069, 15893, 15679, 15426,
+	15137, 14811, 14449, 14053, 13623, 13160, 12665, 12140,
+	11585, 11003, 10394, 9760, 9102, 8423, 7723, 7005,
+	6270, 5520, 4756, 3981, 3196, 2404, 1606, 804,
+	0, -804, -1606, -2404, -3196, -3981, -4756, -5520,
+	-6270, -7005, -7723, -8423, -9102, -9760, -10394, -11003,
+	-11585, -12140, -12665, -13160, -13623, -14053, -14449, -14811,
+	-15137, -15426, -15679, -15893, -16069, -16207, -16305, -16364
+};
+
+//Hann window, 0..255
+prog_uchar fft_window[fft_n] = {
+	0, 0, 1, 1, 2, 4, 6, 8, 10, 12, 15, 18, 22, 25, 29, 34,
+	38, 42, 47, 52, 57, 63, 68, 74, 80, 86, 92, 98, 104, 110, 116, 123,
+	129, 135, 142, 148, 154, 160, 166, 172, 178, 184, 189, 195, 200, 205, 210, 215,
+	219, 224, 228, 231, 235, 238, 241, 244, 246, 248, 250, 252, 253, 254, 255, 255,
+	255, 255, 254, 253, 252, 250, 248, 246, 244, 241, 238, 235, 231, 228, 224, 219,
+	215, 210, 205, 200, 195, 189, 184, 178, 172, 166, 160, 154, 148, 142, 135, 129,
+	123, 116, 110, 104, 98, 92, 86, 80, 74, 68, 63, 57, 52, 47, 42, 38,
+	34, 29, 25, 22, 18, 15, 12, 10, 8, 6, 4, 2, 1, 1, 0, 0
+};
+
+//windowed, offset-removed adc_buffer[fft_first..] into
+//fft_re/fft_im in bit-reversed order
+void fft_load(void) {
+	uint8_t i, j, k, r;
+
+	for (i = 0; i < fft_n; i++) {
+		r = 0;
+		for (j = 0, k = i; j < fft_log2n; j++, k >>= 1) r = (r << 1) | (k & 1);
+		fft_re[r] = (((int)adc_buffer[fft_first+i] - 128) * pgm_read_byte(&fft_window[i])) >> 3;
+		fft_im[r] = 0;
+	}
+}
+
+//one stage, butterflies size/2 apart: 64 of them, each with
+//four 16x16->32 multiplies
+void fft_stage(uint8_t size) {
+	uint8_t i, j, k, half = size >> 1, step = fft_n / size;
+	int wr, wi, tr, ti, ar, ai;
+
+	for (k = 0; k < half; k++) {
+		wr = (int16_t)pgm_read_word(&fft_sin[k*step + fft_n/4]);	//cos
+		wi = -(int16_t)pgm_read_word(&fft_sin[k*step]);	//-sin
+		for (i = k; i < fft_n; i += size) {
+			j = i + half;
+			//Q14 twiddle, >> 15 also does the halving; rounded,
+			//as truncating left every bin a few counts low
+			//(host/ffttest.c)
+			tr = ((int32_t)wr * fft_re[j] - (int32_t)wi * fft_im[j] + 0x4000) >> 15;
+			ti = ((int32_t)wr * fft_im[j] + (int32_t)wi * fft_re[j] + 0x4000) >> 15;
+			ar = fft_re[i] >> 1;
+			ai = fft_im[i] >> 1;
+			fft_re[j] = ar - tr;
+			fft_im[j] = ai - ti;
+			fft_re[i] = ar + tr;
+			fft_im[i] = ai + ti;
+		}
+	}
+}
+
+//the whole transform, about 450 butterflies; task_render runs
+//the stages one at a time instead
+void fft_run(void) {
+	uint8_t size;
+
+	fft_load();
+	for (size = 2; size && size <= fft_n; size <<= 1) fft_stage(size);
+}
+
+//replace the trace with magnitude bars, two columns per bin
+//bar height is 8 rows per doubling of magnitude (6 dB)
+void fft_bars(void) {
+	uint8_t k, e, h;
+	unsigned int a, b, mag;
+
+	for (k = 0; k < fft_n/2; k++) {
+		//|X| ~ max + 3/8 min, within 7%
+		a = abs(fft_re[k]);
+		b = abs(fft_im[k]);
+		if (a < b) {
+			mag = a;
+			a = b;
+			b = mag;
+		}
+		mag = a + (b >> 2) + (b >> 3);
+
+		//integer log2 with three fraction bits
+		h = 0;
+		if (mag) {
+			for (e = 15; !(mag & 0x8000); e--) mag <<= 1;
+			h = (e << 3) | ((mag >> 12) & 7);
+		}
+
+		//the bar runs from 127-h down to the bottom row
+		adc_min_buffer[2*k] = adc_min_buffer[2*k+1] = (127 - h) << 1;
+		adc_buffer[2*k] = adc_buffer[2*k+1] = 255;
+	}
+	memset(adc_min_buffer+fft_n, 255, trace_length-fft_n);
+	memset(adc_buffer+fft_n, 255, trace_length-fft_n);
+}
+
+//==================================
+//the next scanline, at the start of its sync pulse
+//(the raster ISR, and acq_burst while that is masked)
+static inline void line_next(void) {
 	LineCount++;   
   
 	//begin inverted (Vertical) synch after line 247
@@ -1366,6 +2290,117 @@ ISR (TIMER1_COMPA_vect) {
   	//start new frame after line 262
 	if (LineCount==263)
 		LineCount = 1;
+
+	if (LineCount == ScreenBot) frame_count++;
+}
+
+//==================================
+//burst capture, for sample rates the raster ISR cannot reach
+//Timer 0 compare match A auto-triggers the ADC and ADC_vect feeds
+//the trigger engine. Any other interrupt would jitter the sync
+//pulses, so the raster ISR is masked for the capture and the wait
+//loop makes the sync pulses from timer 1, which runs on; ADC_vect
+//can delay one by its own length, a few us the TV rides through.
+//Auto and normal stay inside the blanking lines and carry the
+//trigger state into the next frame; only single shot waits longer,
+//up to about 50 ms, with the picture dark. Call in vertical blanking.
+void acq_burst(void) {
+	uint16_t n, t, last;
+	int w;
+
+	//stop the raster and hold the line at black
+	TIMSK1 = 0;
+	UCSR0B = 0;
+	PORTD = syncOFF;
+
+	//lines to wait, ending on the last blank one
+	w = ScreenTop - 1 - LineCount;
+	if (w < 0) w += 262;
+	n = (trig_mode == TrigSingle) ? 800 : (w > 0) ? w : 1;
+
+	//timer 0 in CTC mode is the sample clock
+	TCCR0A = _BV(WGM01);
+	OCR0A = acq_ocr;
+	TCNT0 = 0;
+	TIFR0 = _BV(OCF0A);
+	ADCSRB = _BV(ADTS1) | _BV(ADTS0);	//trigger on timer 0 compare A
+	ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIE) | _BV(ADIF) | acq_adps;
+	TCCR0B = acq_clock;
+
+	//timer 1 wrapping is a new line: its sync pulse as the raster
+	//ISR makes it, then stop at the start of a line once the capture
+	//is complete or the lines are used up
+	for (last = TCNT1; ; last = t) {
+		t = TCNT1;
+		if (t >= last) continue;
+		PORTD = syncON;
+		line_next();
+		_delay_us(3);
+		PORTD = syncOFF;
+		if (adc_complete || --n == 0) break;
+	}
+
+	//back to one conversion per raster slot, prescaler 16
+	TCCR0B = 0;
+	ADCSRA = _BV(ADEN) | _BV(ADIF) | 4;
+	ADCSRB = 0;
+	ADCSRA |= _BV(ADSC);
+
+	//the raster ISR takes over at the end of this line
+	TIFR1 = _BV(OCF1A) | _BV(OCF1B);
+	TIMSK1 = _BV(OCIE1B) | _BV(OCIE1A);
+}
+
+//burst sample: has to end before the next timer 0 match, or that
+//conversion is never started (PROFILE checks this, see prof_burst_max)
+ISR (ADC_vect) {
+#ifdef PROFILE
+	uint8_t t;
+#endif
+	acq_sample(ADCH, adc_chan);
+	adc_switch();
+	TIFR0 = _BV(OCF0A);	//clear the flag so the next match triggers
+#ifdef PROFILE
+	//timer 0 runs at fosc here, so this is cycles since the match that
+	//started the conversion; under the 108 of the conversion means the
+	//count went round and the next match came before the clear
+	t = TCNT0;
+	if (t < 108) t = 255;
+	if (t > prof_burst_max) prof_burst_max = t;
+#endif
+}
+
+// put the MCU to sleep JUST before the CompA ISR goes off
+ISR(TIMER1_COMPB_vect, ISR_NAKED)
+{
+	sei();
+	sleep_cpu();
+	reti();
+}
+
+
+//==================================
+//This is the sync generator and raster generator. It MUST be entered from 
+//sleep mode to get accurate timing of the sync pulses
+
+ISR (TIMER1_COMPA_vect) {
+	uint8_t sample0, sample1, chan0, chan1, t0, t1, t2;
+	int row;
+#ifdef PROFILE
+	uint16_t cycles;
+#endif
+	char *scan;
+#ifdef ROLL_SCROLL
+	char *ws, *we;
+#endif
+#ifdef GRATICULE
+	char *ov;
+#endif
+	//start the Horizontal sync pulse    
+	PORTD = syncON;
+
+	//update the current scanline number
+	line_next();
       
 	//adjust to make 5 us pulses
 	_delay_us(3);
@@ -1375,123 +2410,149 @@ ISR (TIMER1_COMPA_vect) {
 
 	if (LineCount < ScreenBot && LineCount >= ScreenTop) {
 
-		//compute offset into screen array
-		//screenStart = ((LineCount - ScreenTop) << 4) + ((LineCount - ScreenTop) << 3) ;
-		screenStart0  = (LineCount - ScreenTop) * bytes_per_line;
-		screenStart1  = screenStart0  + 1;
-		screenStart2  = screenStart1  + 1;
-		screenStart3  = screenStart2  + 1;
-		screenStart4  = screenStart3  + 1;
-		screenStart5  = screenStart4  + 1;
-		screenStart6  = screenStart5  + 1;
-		screenStart7  = screenStart6  + 1;
-		screenStart8  = screenStart7  + 1;
-		screenStart9  = screenStart8  + 1;
-		screenStart10 = screenStart9  + 1;
-		screenStart11 = screenStart10 + 1;
-		screenStart12 = screenStart11 + 1;
-		screenStart13 = screenStart12 + 1;
-		screenStart14 = screenStart13 + 1;
-		screenStart15 = screenStart14 + 1;
-		screenStart16 = screenStart15 + 1;
-		screenStart17 = screenStart16 + 1;
-		screenStart18 = screenStart17 + 1;
-		screenStart19 = screenStart18 + 1;
-
-
+		//walk the line with one pointer
+		scan = scan_next;
+#ifdef ROLL_SCROLL
+		ws = scan_row;
+		we = scan_row + bytes_per_line;
+#endif
+#ifdef GRATICULE
+		ov = grat_next;
+#endif
 
 		//blast the data to the screen
 		// We can load UDR twice because it is double-bufffered
-		UDR0 = screen[screenStart0] ;
+#ifdef __AVR__
+		asm volatile(
+			SCAN_EMIT
+			"ldi %[t0], %[txen]\n\t"
+			"sts %[ucsrb], %[t0]\n\t"
+			SCAN_EMIT
+			//only latch the sample here, the trigger runs after the scanout
+			SCAN_ADC1("%[s0]", "%[c0]")
+			"scan_wait %[pa]\n\t"
+			SCAN_EMIT
+			SCAN_ADC2
+			"scan_wait %[p2]\n\t"
+			SCAN_EMIT
+			".rept %[mid]\n\t"
+			"scan_wait %[pad]\n\t"
+			SCAN_EMIT
+			".endr\n\t"
+			SCAN_ADC1("%[s1]", "%[c1]")
+			"scan_wait %[p1]\n\t"
+			SCAN_EMIT
+			SCAN_ADC2
+			"scan_wait %[p2]\n\t"
+			SCAN_EMIT
+			"scan_wait %[pad]\n\t"
+			SCAN_EMIT
+			: [s0] "=&r" (sample0), [c0] "=&r" (chan0),
+			  [s1] "=&r" (sample1), [c1] "=&r" (chan1),
+			  [t0] "=&d" (t0), [t1] "=&d" (t1), [t2] "=&d" (t2),
+#ifdef GRATICULE
+			  "+z" (ov),
+#endif
+			  "+x" (scan)
+			: [udr] "n" (_SFR_MEM_ADDR(UDR0)),
+#ifdef ROLL_SCROLL
+			  [ws] "r" (ws), [we] "r" (we),
+#endif
+			  [ucsrb] "n" (_SFR_MEM_ADDR(UCSR0B)),
+			  [txen] "M" (_BV(TXEN0)),
+			  [adch] "n" (_SFR_MEM_ADDR(ADCH)),
+			  [mux] "n" (_SFR_MEM_ADDR(ADMUX)),
+			  [adcsra] "n" (_SFR_MEM_ADDR(ADCSRA)),
+			  [admux] "M" (adc_admux),
+			  [adsc] "M" (_BV(ADSC)),
+			  [chan] "i" (&adc_chan),
+			  [dual] "i" (&acq_dual),
+			  [mid] "n" (bytes_per_line - 7),
+			  [pa] "n" (scan_pad_a),
+			  [pad] "n" (scan_pad),
+			  [p1] "n" (scan_pad_1),
+			  [p2] "n" (scan_pad_2)
+			: "memory");
+#else
+		//reference version for non-AVR builds, same byte order
+		UDR0 = scan_byte();
+		scan_wrap();
 		UCSR0B = _BV(TXEN0);
-		UDR0 = screen[screenStart1] ;
-		if(draw_complete){
-			//while( ADCSRA & (1<<ADSC));
-			adc_buffer[adc_index++] = ADCH;
-			ADCSRA |= (1<<ADSC);
-			if (adc_index == 160){
-				adc_complete = 1;
-				adc_index = 0;
-			}
+		UDR0 = scan_byte();
+		scan_wrap();
+		sample0 = ADCH;
+		chan0 = adc_chan;
+		adc_switch();
+		ADCSRA |= (1<<ADSC);
+		for (t0 = 2; t0 < bytes_per_line - 3; t0++) {
+			UDR0 = scan_byte();
+			scan_wrap();
 		}
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart2] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart3] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart4] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart5] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart6] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart7] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart8] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart9] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart10] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart11] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart12] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart13] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart14] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart15] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart16] ;
-
-		if(draw_complete){
-			//while( ADCSRA & (1<<ADSC));
-			adc_buffer[adc_index++] = ADCH;
-			ADCSRA |= (1<<ADSC);
-			if (adc_index == 160 && draw_complete){
-				adc_complete = 1;
-				adc_index = 0;
-			}
+		sample1 = ADCH;
+		chan1 = adc_chan;
+		adc_switch();
+		ADCSRA |= (1<<ADSC);
+		for (; t0 < bytes_per_line; t0++) {
+			UDR0 = scan_byte();
+			scan_wrap();
 		}
-
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart17] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart18] ;
-		while (!(UCSR0A & _BV(UDRE0))) ;
-		UDR0 = screen[screenStart19] ;
-
-
+#endif
 
 		UCSR0B = 0 ;
 
+		//the last two bytes are still shifting out
+		if(draw_complete && acq_source == AcqLine){
+			acq_sample(sample0, chan0);
+			acq_sample(sample1, chan1);
+		}
+
 	}else{
+		//swap in a finished back page on any blank line, so the
+		//render task never waits out a visible frame for it
+		if (flip_pending) {
+			scan_screen = screen;
+			flip_pending = 0;
+		}
 		_delay_us(10);
-		if(draw_complete){
-			adc_buffer[adc_index++] = ADCH;
+		if(draw_complete && acq_source == AcqLine){
+			acq_sample(ADCH, adc_chan);
+			adc_switch();
 			ADCSRA |= (1<<ADSC);
-			if (adc_index == 160 && draw_complete){
-				adc_complete = 1;
-				adc_index = 0;
-			}
 		}
 		_delay_us(28);
-		if(draw_complete){
-			adc_buffer[adc_index++] = ADCH;
+		if(draw_complete && acq_source == AcqLine){
+			acq_sample(ADCH, adc_chan);
+			adc_switch();
 			ADCSRA |= (1<<ADSC);
-			if (adc_index == 160 && draw_complete){
-				adc_complete = 1;
-				adc_index = 0;
-			}
 		}
 	}
+
+	//set up the next line while there is time
+	//(a page flip above has already happened)
+	row = (LineCount + 1 - ScreenTop) >> line_shift;
+	scan_row = scan_next = scan_screen + row * bytes_per_line;
+#ifdef ROLL_SCROLL
+	if ((uint8_t)(row - trace_top) < trace_height) scan_next += roll_byte;
+#endif
+#ifdef GRATICULE
+	grat_next = grat_line(row);
+#endif
+
+#ifdef PROFILE
+	cycles = TCNT1;
+	if (LineCount >= ScreenTop && LineCount < ScreenBot) {
+		if (cycles > prof_line_max) prof_line_max = cycles;
+	}
+	else if (cycles > prof_blank_max) prof_blank_max = cycles;
+	prof_isr_cycles += cycles;
+#endif
 }
 
+
 //==================================
 //plot one point 
 //at x,y with color 1=white 0=black 2=invert 
-void video_pt(char x, char y, char c) {
+void video_pt(xcoord x, char y, char c) {
 	//each line has 18 bytes
 	//calculate i based upon this and x,y
 	// the byte with the pixel in it
@@ -1506,17 +2567,382 @@ void video_pt(char x, char y, char c) {
 	  screen[i] = screen[i] ^ pos[x & 7];
 }
 
+//==================================
+//apply a pixel mask to one byte
+//color 1=white 0=black 2=invert 
+static inline void video_mask(char *p, uint8_t mask, char c) {
+	if (c == 1) *p |= mask;
+	else if (c == 0) *p &= ~mask;
+	else *p ^= mask;
+}
+
+//==================================
+//horizontal run from x1 to x2 (either order) on row y
+//masked bytes at the ends, whole bytes in between
+void video_hline(xcoord x1, xcoord x2, char y, char c) {
+	char *p, *e;
+	uint8_t lm, rm;
+	xcoord t;
+
+	if (x1 > x2) {
+		t = x1;
+		x1 = x2;
+		x2 = t;
+	}
+	p = screen + (int)y * bytes_per_line;
+	e = p + (x2 >> 3);
+	p += x1 >> 3;
+	lm = 0xff >> (x1 & 7);
+	rm = 0xff << (7 - (x2 & 7));
+
+	if (p == e) {
+		video_mask(p, lm & rm, c);
+		return;
+	}
+	video_mask(p++, lm, c);
+	if (c == 2)
+		while (p < e) { *p = ~*p; p++; }
+	else {
+		lm = (c == 1) ? 0xff : 0;
+		while (p < e) *p++ = lm;
+	}
+	video_mask(p, rm, c);
+}
+
+//==================================
+//vertical run from y1 to y2 (either order) in column x
+//one mask, stepping down a line at a time
+void video_vline(xcoord x, char y1, char y2, char c) {
+	char *p;
+	uint8_t n, mask = pos[x & 7];
+
+	if (y1 > y2) {
+		n = y1;
+		y1 = y2;
+		y2 = n;
+	}
+	n = y2 - y1 + 1;
+	p = screen + (x >> 3) + (int)y1 * bytes_per_line;
+
+	if (c == 1)
+		do { *p |= mask; p += bytes_per_line; } while (--n);
+	else if (c == 0)
+		do { *p &= ~mask; p += bytes_per_line; } while (--n);
+	else
+		do { *p ^= mask; p += bytes_per_line; } while (--n);
+}
+
+//==================================
+//filled rectangle between two corners
+//color 2 inverts it, for cursors and highlights
+void video_rect(xcoord x1, char y1, xcoord x2, char y2, char c) {
+	uint8_t y;
+
+	if (y1 > y2) {
+		y = y1;
+		y1 = y2;
+		y2 = y;
+	}
+	for (y = y1; ; y++) {
+		video_hline(x1, x2, y, c);
+		if (y == y2) break;
+	}
+}
+
+//==================================
+//one trace column: a vertical run between rows a and b (either order)
+//below col, color 1=white 2=invert
+//walks down with a bytes_per_line stride and a fixed mask
+static inline void trace_span(char *col, uint8_t mask, uint8_t a, uint8_t b, char c) {
+	char *p;
+	uint8_t n;
+
+	if (a > b) {
+		n = a;
+		a = b;
+		b = n;
+	}
+	n = b - a + 1;
+	p = col + (int)a * bytes_per_line;
+
+	if (c == 2)
+		do { *p ^= mask; p += bytes_per_line; } while (--n);
+	else
+		do { *p |= mask; p += bytes_per_line; } while (--n);
+}
+
+//==================================
+//trace row for sample v moved by off rows, kept inside the trace area
+static inline uint8_t trace_row(uint8_t v, signed char off) {
+	int r = (v >> trace_shift) + off;
+
+	if (r < 0) return 0;
+	if (r > trace_height-1) return trace_height-1;
+	return r;
+}
+
+//==================================
+//XOR-redraw only the trace columns of channel ch whose span changed
+//column j runs from min[j] to max[j], stretched to meet column j-1
+//so the trace stays connected; with min == max that is a run from
+//sample j-1 to sample j. Each page remembers the rows it has drawn,
+//so a stable signal costs a compare per column and a changed one
+//about 27 cycles plus 10 per pixel, against roughly 48 per dot
+//for the old video_pt loops
+void trace_update(uint8_t ch, uint8_t *min, uint8_t *max) {
+	char *col = screen + trace_top*bytes_per_line;
+	uint8_t *olo = trace_lo[draw_page][ch];
+	uint8_t *ohi = trace_hi[draw_page][ch];
+	signed char off = trace_pos[ch];
+	uint8_t mask = 0x80;
+	uint8_t j, a, b, lo, hi;
+	uint8_t pmin = trace_row(min[0], off);
+	uint8_t pmax = trace_row(max[0], off);
+
+	for (j = 0; j < trace_length; j++) {
+		a = trace_row(min[j], off);
+		b = trace_row(max[j], off);
+		lo = (a > pmax) ? pmax : a;
+		hi = (b < pmin) ? pmin : b;
+		pmin = a;
+		pmax = b;
+
+		if (lo != olo[j] || hi != ohi[j]) {
+			if (olo[j] <= ohi[j]) trace_span(col, mask, olo[j], ohi[j], 2);
+			trace_span(col, mask, lo, hi, 2);
+			olo[j] = lo;
+			ohi[j] = hi;
+		}
+
+		mask >>= 1;
+		if (mask == 0) {
+			mask = 0x80;
+			col++;
+		}
+	}
+}
+
+//==================================
+//remove channel ch's trace from the current page
+void trace_erase(uint8_t ch) {
+	char *col = screen + trace_top*bytes_per_line;
+	uint8_t *olo = trace_lo[draw_page][ch];
+	uint8_t *ohi = trace_hi[draw_page][ch];
+	uint8_t mask = 0x80;
+	uint8_t j;
+
+	for (j = 0; j < trace_length; j++) {
+		if (olo[j] <= ohi[j]) {
+			trace_span(col, mask, olo[j], ohi[j], 2);
+			olo[j] = 255;
+			ohi[j] = 0;
+		}
+
+		mask >>= 1;
+		if (mask == 0) {
+			mask = 0x80;
+			col++;
+		}
+	}
+}
+
+//==================================
+//roll mode: column x of channel ch becomes rows a..b (a > b for
+//nothing) on every page, so no page flips are needed
+void roll_column(uint8_t ch, uint8_t x, uint8_t a, uint8_t b) {
+	char *col = screen_page[0] + trace_top*bytes_per_line + (x >> 3);
+	uint8_t mask = pos[x & 7];
+	uint8_t p, *lo, *hi;
+
+	for (p = 0; p < screen_pages; p++) {
+		lo = &trace_lo[p][ch][x];
+		hi = &trace_hi[p][ch][x];
+		if (*lo <= *hi) trace_span(col, mask, *lo, *hi, 2);
+		if (a <= b) trace_span(col, mask, a, b, 2);
+		*lo = a;
+		*hi = b;
+		col += screen_array_size;
+	}
+}
+
+#ifdef ROLL_SCROLL
+//the side borders of the trace rows where they land on screen with
+//the rows started r bytes in, on every page
+//XOR, so a second call takes them out again and the trace columns
+//underneath are left alone
+void roll_border(uint8_t r) {
+	char *p = screen_page[0] + trace_top*bytes_per_line;
+	uint8_t l = r, rt = (r ? r : bytes_per_line) - 1;
+	uint8_t k, y;
+
+	for (k = 0; k < screen_pages; k++) {
+		for (y = 0; y < trace_height; y++) {
+			p[l] ^= 0x80;
+			p[rt] ^= 0x01;
+			p += bytes_per_line;
+		}
+		p += screen_array_size - trace_height*bytes_per_line;
+	}
+}
+
+//rotate the trace rows to start r bytes in, moving the borders along
+void roll_scroll(uint8_t r) {
+	if (r == roll_byte) return;
+	roll_border(roll_byte);
+	roll_border(r);
+	roll_byte = r;
+}
+#else
+#define roll_scroll(r)
+#endif
+
+//enter or leave roll mode
+//entering clears both traces; leaving puts the scanout back and
+//rearms the trigger, the next capture redraws over the roll columns
+void roll_set(uint8_t on) {
+	uint8_t x;
+
+	trig_state = TrigHold;
+	adc_complete = 0;
+	acq_roll = on;
+	roll_scroll(0);
+	if (on) {
+		for (x = 0; x < trace_length; x++) {
+			roll_column(0, x, 255, 0);
+			roll_column(1, x, 255, 0);
+		}
+		roll_col = 0;
+		roll_last[0] = roll_last[1] = 255;
+		level_reset(&roll_level);
+	}
+	//re-arms, and moves off timebases too fast to roll
+	timebase_set(timebase);
+	roll_read = adc_index;
+}
+
+//draw the samples committed since the last call, one column each:
+//the rows from the previous sample to this one (or the peak range)
+//a new byte of columns is blanked first, so the pen has a gap ahead
+//returns 1 when the trace wrapped and new measurements are ready
+uint8_t roll_update(void) {
+	uint8_t i = roll_read, head = adc_index;
+	uint8_t ch, x, a, b, r, k, wrapped = 0;
+
+	while (i != head) {
+		if ((roll_col & 7) == 0) {
+			for (x = roll_col; x < roll_col + 8; x++) {
+				roll_column(0, x, 255, 0);
+				roll_column(1, x, 255, 0);
+			}
+		}
+		for (ch = 0; ch <= acq_dual; ch++) {
+			r = trace_row(ch ? adc_ring_b[i] : adc_ring[i], trace_pos[ch]);
+			a = (ch == 0 && acq_mode == AcqPeak) ? trace_row(adc_ring_min[i], trace_pos[0]) : r;
+			b = r;
+			if (a > b) {
+				b = a;
+				a = r;
+			}
+			if (roll_last[ch] != 255) {
+				if (roll_last[ch] < a) a = roll_last[ch];
+				if (roll_last[ch] > b) b = roll_last[ch];
+			}
+			roll_last[ch] = r;
+			roll_column(ch, roll_col, a, b);
+		}
+		level_add(&roll_level, adc_ring[i]);
+		i++;
+
+		if (++roll_col == trace_length) {
+			roll_col = 0;
+			//measurements over the last screen width: hand the
+			//ISR a fresh bank, the old one is then left alone
+			//(a one-byte store, no need to hold off the raster)
+			k = meas_cur;
+			meas_reset(&meas_bank[k ^ 1]);
+			meas_cur = k ^ 1;
+			meas_last = meas_bank[k];
+			level_last = roll_level;
+			level_reset(&roll_level);
+			wrapped = 1;
+		}
+	}
+	roll_read = i;
+
+#ifdef ROLL_SCROLL
+	//the byte being written ends up at the right edge
+	x = (roll_col >> 3) + 1;
+	roll_scroll((x == trace_length/8) ? 0 : x);
+#endif
+	return wrapped;
+}
+
+//=== XY view =========================================================
+//the last xy_history points stay on screen; each new point is XORed
+//in and the oldest XORed back out, so nothing is ever cleared
+//(two history points on one pixel cancel, which just looks dimmer)
+uint8_t xy_x[xy_history], xy_y[xy_history];
+uint16_t xy_head, xy_count;
+
+//invert one point of the trace area on every page
+void xy_pt(uint8_t x, uint8_t y) {
+	int i = (x >> 3) + (trace_top + y) * bytes_per_line;
+	uint8_t p;
+
+	for (p = 0; p < screen_pages; p++)
+		screen_page[p][i] ^= pos[x & 7];
+}
+
+//add the collected pairs to the history
+//x spans the trace columns, y the trace rows
+void xy_plot(void) {
+	uint8_t j, x, y;
+
+	for (j = 0; j < trace_length; j++) {
+		if (xy_count == xy_history) xy_pt(xy_x[xy_head], xy_y[xy_head]);
+		else xy_count++;
+
+		x = ((uint16_t)adc_buffer[j] * trace_length) >> 8;
+		y = adc_buffer_b[j] >> trace_shift;
+		xy_pt(x, y);
+		xy_x[xy_head] = x;
+		xy_y[xy_head] = y;
+		if (++xy_head == xy_history) xy_head = 0;
+	}
+}
+
+//remove the whole history
+void xy_clear(void) {
+	while (xy_count) {
+		if (xy_head == 0) xy_head = xy_history;
+		xy_head--;
+		xy_pt(xy_x[xy_head], xy_y[xy_head]);
+		xy_count--;
+	}
+	xy_head = 0;
+}
+
 //==================================
 //plot a line 
 //at x1,y1 to x2,y2 with color 1=white 0=black 2=invert 
 //NOTE: this function requires signed chars   
 //Code is from David Rodgers,
 //"Procedural Elements of Computer Graphics",1985
-void video_line(char x1, char y1, char x2, char y2, char c) {
+void video_line(xcoord x1, char y1, xcoord x2, char y2, char c) {
 	int e;
 	signed int dx,dy,j, temp;
 	signed char s1,s2, xchange;
     signed int x,y;
+
+	//axis-aligned lines go to the byte-wise runs
+	if (y1 == y2) {
+		video_hline(x1, x2, y1, c);
+		return;
+	}
+	if (x1 == x2) {
+		video_vline(x1, y1, y2, c);
+		return;
+	}
         
 	x = x1;
 	y = y1;
@@ -1582,27 +3008,27 @@ void video_line(char x1, char y1, char x2, char y2, char c) {
 //==================================
 // put a big character on the screen
 // c is index into bitmap
-void video_putchar(char x, char y, char c) { 
-    char i;
-	char y_pos;
-	uint8_t j;
+// each 5-bit glyph row is shifted once into a byte pair
+// and merged under a mask, so a glyph costs 7 row writes
+void video_putchar(xcoord x, char y, char c) { 
+	char i;
+	uint8_t s = x & 7;
+	uint16_t w, m = 0xf800 >> s;
+	char *p = screen + (x >> 3) + (int)y * bytes_per_line;
+	const prog_char *g = ascii[(uint8_t)c];
 
 	for (i=0;i<7;i++) {
-        y_pos = y + i;
-
-		j = pgm_read_byte(((uint32_t)(ascii)) + c*7 + i);
-
-        video_pt(x,   y_pos, (j & 0x80)==0x80);  
-        video_pt(x+1, y_pos, (j & 0x40)==0x40); 
-        video_pt(x+2, y_pos, (j & 0x20)==0x20);
-        video_pt(x+3, y_pos, (j & 0x10)==0x10);
-        video_pt(x+4, y_pos, (j & 0x08)==0x08);
-    }
+		w = ((uint16_t)(pgm_read_byte(g + i) & 0xf8) << 8) >> s;
+		p[0] = (p[0] & ~(m >> 8)) | (w >> 8);
+		//glyphs at x&7 > 3 spill into the next byte
+		if (s > 3) p[1] = (p[1] & ~m) | w;
+		p += bytes_per_line;
+	}
 }
 
 //==================================
 // put a string of big characters on the screen
-void video_puts(char x, char y, char *str) {
+void video_puts(xcoord x, char y, char *str) {
 	char i;
 	for (i=0; str[i]!=0; i++) { 
 		video_putchar(x,y,str[i]);
@@ -1610,46 +3036,47 @@ void video_puts(char x, char y, char *str) {
 	}
 }
       
-//==================================
-// put a small character on the screen
-// x-coord must be on divisible by 4 
-// c is index into bitmap
-void video_smallchar(char x, char y, char c) { 
-	char mask;
-	//int i=((int)x>>3) + ((int)y<<4) + ((int)y<<1);
-	int i=((int)x>>3) + (int)y * bytes_per_line ;
-
-	if (x == (x & 0xf8)) mask = 0x0f;     //f8
-	else mask = 0xf0;
-	
-	uint8_t j = pgm_read_byte(((uint32_t)(smallbitmap)) + c*5);
-	screen[i]    =    (screen[i] & mask) | (j & ~mask);
-
-	j = pgm_read_byte(((uint32_t)(smallbitmap)) + c*5 + 1);
-   	screen[i+bytes_per_line] = (screen[i+bytes_per_line] & mask) | (j & ~mask);
-
-	j = pgm_read_byte(((uint32_t)(smallbitmap)) + c*5 + 2);
-    screen[i+bytes_per_line*2] = (screen[i+bytes_per_line*2] & mask) | (j & ~mask);
-    
-	j = pgm_read_byte(((uint32_t)(smallbitmap)) + c*5 + 3);
-	screen[i+bytes_per_line*3] = (screen[i+bytes_per_line*3] & mask) | (j & ~mask);
-   	
-	j = pgm_read_byte(((uint32_t)(smallbitmap)) + c*5 + 4);
-	screen[i+bytes_per_line*4] = (screen[i+bytes_per_line*4] & mask) | (j & ~mask); 
-}
-
 //==================================
 // put a string of small characters on the screen
-// x-cood must be on divisible by 4 
-void video_putsmalls(char x, char y, char *str) {
-	char i;
-	x = x & 0b11111100; //make it divisible by 4
-	for (i = 0; str[i] != 0; i++) {
-		if (str[i] >= 0x30 && str[i] <= 0x3a) 
-			video_smallchar(x, y, str[i] - 0x30);
+// a 4-pixel cell per character; any x works
+// each row of the whole string is streamed out a byte at a time
+#define small_max (screen_width / 4)
+static inline uint8_t small_index(char c) {
+	if (c >= 0x30 && c <= 0x3a) return c - 0x30;
+	if (c == '=') return 11;
+	if (c == ' ') return 12;
+	if (c == '.') return 39;
+	if (c == '%') return 40;
+	if (c == '-') return 41;
+	if (c == '+') return 42;
+	return c - 0x40 + 12;
+}
 
-        else video_smallchar(x, y, str[i]-0x40+12);
-		x += 4;	
+void video_putsmalls(xcoord x, char y, char *str) {
+	uint8_t g[small_max];
+	uint8_t i, k, n, r, s = x & 7;
+	uint16_t acc;
+	char *q, *row = screen + (x >> 3) + (int)y * bytes_per_line;
+
+	for (k = 0; str[k] != 0 && k < small_max; k++)
+		g[k] = small_index(str[k]);
+
+	for (r = 0; r < 5; r++) {
+		q = row;
+		//start with the pixels left of x already in the first byte
+		acc = (uint8_t)*q >> (8 - s);
+		n = s;
+		for (i = 0; i < k; i++) {
+			acc = (acc << 4) | (pgm_read_byte(&smallbitmap[g[i]][r]) & 0x0f);
+			n += 4;
+			if (n >= 8) {
+				n -= 8;
+				*q++ = acc >> n;
+			}
+		}
+		//merge the leftover bits, keeping the rest of the byte
+		if (n) *q = (acc << (8 - n)) | (*q & (0xff >> n));
+		row += bytes_per_line;
 	}
 }
 
@@ -1674,6 +3101,22 @@ int multfix(int a, int b) {
 } 
 
 
+//=== integer square root ============================
+uint16_t isqrt(uint32_t a) {
+	uint32_t root = 0, bit = 1UL << 30;
+
+	while (bit > a) bit >>= 2;
+	while (bit) {
+		if (a >= root + bit) {
+			a -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else root >>= 1;
+		bit >>= 2;
+	}
+	return root;
+}
+
 //=== fixed conversion macros ========================================= 
 #define int2fix(a)   (((int)(a))<<8)            //Convert char to fix. a is a char
 #define fix2int(a)   ((signed char)((a)>>8))    //Convert fix to int. a is an int
@@ -1682,33 +3125,381 @@ int multfix(int a, int b) {
 
 //=== animation stuff ==================================================
 char cu1[]="Cornell  ECE 4760";
-char cu2[]="F: ";
 uint8_t PushFlag;
 uint8_t PushState;
-uint8_t running;
-volatile uint8_t inputTimer, buttonTimer
+uint8_t PushButton;	//buttons down when the push was accepted
+volatile uint8_t inputTimer, buttonTimer;
 //State machine state names
 #define NoPush 1 
 #define MaybePush 2
 #define Pushed 3
 #define MaybeNoPush 4
 
+//buttons: B.0 steps through the menu, B.1 and B.2 change the value
+#define MenuTime 0
+#define MenuRun 1
+#define MenuTrig 2
+#define MenuEdge 3
+#define MenuLevel 4
+#define MenuHyst 5
+#define MenuMode 6
+#define MenuAvg 7
+#define MenuView 8
+#define MenuDual 9
+#define MenuPos1 10
+#define MenuPos2 11
+#define MenuMem 12
+#define MenuZoom 13
+#define MenuPan 14
+#define menu_items 15
+char *menu_name[menu_items] = {"TIME=", "RUN= ", "TRIG=", "EDGE=", "LEVL=", "HYST=",
+	"MODE=", "AVG= ", "VIEW=", "CH2= ", "POS1=", "POS2=", "MEM= ", "ZOOM=", "PAN= "};
+char *trig_name[] = {"AUTO ", "NORM ", "SNGL "};
+char *edge_name[] = {"RISE ", "FALL "};
+#define TrigStep 8	//ADC codes a push, about 0.16 V
+#define TrigHystMax 32
+char *mode_name[] = {"NORM ", "PEAK ", "AVG  ", "EXP  "};
+//display views
+#define ViewYT 0	//trace against time
+#define ViewFFT 1	//magnitude spectrum of the capture
+#define ViewXY 2	//ADC1 against ADC0 with a fading point history
+#define ViewRoll 3	//chart recorder, no trigger
+char *view_name[] = {"YT   ", "FFT  ", "XY   ", "ROLL "};
+#define view_count (sizeof(view_name)/sizeof(view_name[0]))
+uint8_t view;
+char *avg_name[] = {"", "2    ", "4    ", "8    ", "16   ", "32   ", "64   ", "128  ", "256  "};
+#define mode_count (sizeof(mode_name)/sizeof(mode_name[0]))
+uint8_t menu_item;
+#define MenuX 4
+#define MenuY (screen_height-10)
+//measurement readouts
+#define MeasY (screen_height-18)
+#if screen_height-18 < trace_top + trace_height
+#error "no room for the readouts below the trace"
+#endif
+#define FreqX 60
+#define DutyX 112	//"D=100%" ends at 136
+#if DutyX + 24 > screen_width
+#error "no room for the duty readout"
+#endif
+
 ///////////////
 void init(void);
 void check_button_state(void);
 
 void handle_input(void);
 
+//==================================
+//write v as width characters, blank padded on the left,
+//with a decimal point before the last dp digits
+//returns the end of the field
+char *fmt_num(char *s, uint16_t v, uint8_t width, uint8_t dp){
+	char *p = s + width;
+
+	while (p > s) {
+		*--p = '0' + v % 10;
+		v /= 10;
+		if (dp && --dp == 0 && p > s) *--p = '.';
+		else if (v == 0 && dp == 0) break;
+	}
+	while (p > s) *--p = ' ';
+	return s + width;
+}
+
+//==================================
+//small-font text drawn into every page so it survives page flips
+void status_puts(xcoord x, char y, char *str){
+	char *s = screen;
+	uint8_t p;
+
+	for (p = 0; p < screen_pages; p++) {
+		screen = screen_page[p];
+		video_putsmalls(x, y, str);
+	}
+	screen = s;
+}
+
+//==================================
+//the time/div actually running: with CH2 on the fastest settings
+//run at half rate, which is the next setting's label or (for a
+//burst, all well under 1 ms) not in the table at all
+void time_name(char *s) {
+	uint8_t tb;
+
+	for (tb = 0; tb < timebase_count; tb++)
+		if (timebase_period2(tb) == acq_period2) {
+			strcpy(s, timebases[tb].name);
+			return;
+		}
+	strcpy(fmt_num(s, acq_period2 >> 1, 3, 0), "US");
+}
+
+//the time/div always shows at the end of the readout row, whatever
+//the menu is on; timebase_set redraws it, CH2 on or off included
+#define TimeX DutyX
+void time_draw(void) {
+	char str[6];
+
+	time_name(str);
+	status_puts(TimeX, MeasY, str);
+}
+
+//==================================
+//millivolts for an 8-bit ADC code with Vref = Vcc = 5 V
+#define code2mv(c) (((uint32_t)(c) * 5000) >> 8)
+
+//==================================
+//show the selected menu item and its value in the status line
+void menu_draw(){
+	char str[12];
+	signed char p;
+
+	strcpy(str, menu_name[menu_item]);
+	switch (menu_item) {
+	case MenuTime:
+		time_name(str+5);
+		break;
+	case MenuRun:
+		strcat(str, running ? "RUN  " : "STOP ");
+		break;
+	case MenuTrig:
+		strcat(str, trig_name[trig_mode]);
+		break;
+	case MenuEdge:
+		strcat(str, edge_name[trig_slope]);
+		break;
+	case MenuLevel:
+		//volts with two decimals
+		strcpy(fmt_num(str+5, code2mv(trig_level) / 10, 4, 2), "V");
+		break;
+	case MenuHyst:
+		//millivolts
+		strcpy(fmt_num(str+5, code2mv(trig_hyst), 3, 0), "MV");
+		break;
+	case MenuMode:
+		strcat(str, mode_name[acq_mode]);
+		break;
+	case MenuAvg:
+		strcat(str, avg_name[avg_shift]);
+		break;
+	case MenuView:
+		strcat(str, view_name[view]);
+		break;
+	case MenuDual:
+		//on: show the skew between the inputs in microseconds
+		if (acq_dual) strcpy(fmt_num(str+5, acq_skew() >> 4, 3, 0), "US");
+		else strcat(str, "OFF  ");
+		break;
+	case MenuPos1:
+	case MenuPos2:
+		p = trace_pos[menu_item - MenuPos1];
+		str[5] = (p < 0) ? '-' : '+';
+		strcpy(fmt_num(str+6, (p < 0) ? -p : p, 3, 0), " ");
+		break;
+	case MenuMem:
+		strcat(str, acq_deep ? "DEEP " : "NORM ");
+		break;
+	case MenuZoom:
+		//samples per column
+		str[5] = 'X';
+		strcpy(fmt_num(str+6, 1 << deep_zoom, 2, 0), "  ");
+		break;
+	case MenuPan:
+		//first sample of the view
+		*fmt_num(str+5, deep_pan, 5, 0) = 0;
+		break;
+	}
+
+	status_puts(MenuX, MenuY, str);
+}
+
+//==================================
+//turn the last capture's accumulators into readouts
+//32-bit (and one 64-bit) integer divides, once per capture
+void meas_draw(){
+	struct meas *m = &meas_last;
+	struct level *l = &level_last;
+	char str[12], *p;
+	uint32_t mean256, t;
+	uint64_t f;
+
+	if (l->n == 0) return;
+
+	//peak to peak, mean and rms in volts with two decimals
+	str[0] = 'P';
+	str[1] = '=';
+	p = fmt_num(str+2, code2mv(l->max - l->min) / 10, 4, 2);
+	*p++ = 'V';
+	*p = 0;
+	status_puts(4, MeasY, str);
+
+	mean256 = (l->sum << 8) / l->n;
+	str[0] = 'M';
+	p = fmt_num(str+2, code2mv(mean256 >> 4) / 160, 4, 2);
+	*p++ = 'V';
+	*p = 0;
+	status_puts(40, MeasY, str);
+
+	//rms*16 = sqrt(mean square * 256)
+	t = isqrt((l->sumsq / l->n) << 8);
+	str[0] = 'R';
+	p = fmt_num(str+2, code2mv(t) / 160, 4, 2);
+	*p++ = 'V';
+	*p = 0;
+	status_puts(76, MeasY, str);
+
+	//frequency from the first to the last rising crossing
+	str[0] = 'F';
+	if (m->edges < 2) strcpy(str+2, "         ");
+	else {
+		t = m->last - m->first;
+		f = (uint64_t)F_CPU * 2000 * (m->edges - 1) / ((uint64_t)acq_period2 * t);	//mHz
+		//keep what is passed to fmt_num below 65536
+		if (f >= 1000000) {
+			p = fmt_num(str+2, f / 10000, 6, 2);
+			strcpy(p, "KHZ");
+		}
+		else if (f >= 100000) {
+			p = fmt_num(str+2, f / 100, 6, 1);
+			strcpy(p, " HZ");
+		}
+		else if (f >= 1000) {
+			p = fmt_num(str+2, f / 10, 6, 2);
+			strcpy(p, " HZ");
+		}
+		else {
+			p = fmt_num(str+2, f, 6, 3);
+			strcpy(p, " HZ");
+		}
+	}
+	status_puts(FreqX, MenuY, str);
+
+	//duty cycle over the same whole periods
+	str[0] = 'D';
+	if (m->edges < 2) strcpy(str+2, "    ");
+	else {
+		p = fmt_num(str+2, (uint32_t)m->high_last * 100 / (m->last - m->first), 3, 0);
+		strcpy(p, "%");
+	}
+	status_puts(DutyX, MenuY, str);
+}
+
+//==================================
+//change the selected menu item, dir is +1 or -1
+void menu_change(signed char dir){
+	uint16_t w;
+
+	switch (menu_item) {
+	case MenuTime:
+		if (dir > 0 && timebase < timebase_count-1) timebase_set(timebase+1);
+		if (dir < 0 && timebase > 0) timebase_set(timebase-1);
+		break;
+	case MenuRun:
+		//up also re-arms a held single shot
+		if (dir > 0) {
+			running = 1;
+			if (trig_state == TrigHold) trig_arm();
+		}
+		else running = 0;
+		break;
+	//trigger settings restart the capture, a held single shot
+	//included, so a new level can be tried at once
+	case MenuTrig:
+		if (dir > 0 && trig_mode < TrigSingle) trig_mode++;
+		if (dir < 0 && trig_mode > TrigAuto) trig_mode--;
+		trig_set();
+		break;
+	case MenuEdge:
+		trig_slope = (dir > 0) ? TrigRising : TrigFalling;
+		trig_set();
+		break;
+	case MenuLevel:
+		if (dir > 0 && trig_level <= 255 - TrigStep) trig_level += TrigStep;
+		if (dir < 0 && trig_level >= TrigStep) trig_level -= TrigStep;
+		trig_set();
+		break;
+	case MenuHyst:
+		//0, 1, 2, 4 ... codes
+		if (dir > 0 && trig_hyst < TrigHystMax) trig_hyst = trig_hyst ? trig_hyst << 1 : 1;
+		if (dir < 0) trig_hyst >>= 1;
+		trig_set();
+		break;
+	case MenuMode:
+		if (dir > 0 && acq_mode < mode_count-1) acq_mode_set(acq_mode+1);
+		if (dir < 0 && acq_mode > 0) acq_mode_set(acq_mode-1);
+		break;
+	case MenuAvg:
+		if (dir > 0 && avg_shift < 8) avg_shift++;
+		if (dir < 0 && avg_shift > 1) avg_shift--;
+		avg_count = 0;
+		break;
+	case MenuView:
+		if (view == ViewXY) xy_clear();
+		if (view == ViewRoll) roll_set(0);
+		if (dir > 0 && view < view_count-1) view++;
+		if (dir < 0 && view > 0) view--;
+		//XY needs both inputs
+		if (view == ViewXY && !acq_dual) acq_dual_set(1);
+		if (view == ViewRoll) roll_set(1);
+		break;
+	case MenuDual:
+		acq_dual_set(dir > 0);
+		//XY plots CH2 against CH1, so it goes back to a trace
+		if (!acq_dual && view == ViewXY) {
+			xy_clear();
+			view = ViewYT;
+		}
+		break;
+	case MenuPos1:
+	case MenuPos2:
+		//half a division a push, up the screen for positive
+		if (dir > 0 && trace_pos[menu_item - MenuPos1] > -trace_height/2) trace_pos[menu_item - MenuPos1] -= grat_vdiv/2;
+		if (dir < 0 && trace_pos[menu_item - MenuPos1] < trace_height/2) trace_pos[menu_item - MenuPos1] += grat_vdiv/2;
+		break;
+	case MenuMem:
+		acq_deep_set(dir > 0);
+		//XY needs the second input, which deep memory turned off
+		if (acq_deep && view == ViewXY) {
+			xy_clear();
+			view = ViewYT;
+		}
+		break;
+	case MenuZoom:
+		//up zooms in
+		if (!acq_deep) break;
+		if (dir > 0 && deep_zoom > 0) deep_zoom_set(deep_zoom-1);
+		if (dir < 0 && deep_zoom < deep_zmax) deep_zoom_set(deep_zoom+1);
+		//views at different zooms must not be averaged together
+		avg_count = 0;
+		deep_redraw = 1;
+		break;
+	case MenuPan:
+		//a quarter of the view a push
+		if (!acq_deep) break;
+		w = (uint16_t)trace_length << deep_zoom;
+		if (dir > 0) deep_pan = (deep_pan + w/4 < deep_length - w) ? deep_pan + w/4 : deep_length - w;
+		else deep_pan = (deep_pan > w/4) ? deep_pan - w/4 : 0;
+		avg_count = 0;
+		deep_redraw = 1;
+		break;
+	}
+}
+
 void handle_input(){
 
 	inputTimer = 50;
 	if(PushFlag){
 		PushFlag = 0;
-		running ^= running;
+		if (PushButton & 0x01) {
+			menu_item++;
+			if (menu_item == menu_items) menu_item = 0;
+		}
+		else menu_change((PushButton & 0x02) ? 1 : -1);
+		menu_draw();
 	}
 }
 
-void check_button_state{
+void check_button_state(){
   buttonTimer = 50;     //reset the task timer
   switch (PushState){
      case NoPush: 
@@ -1720,6 +3511,7 @@ void check_button_state{
         begin
            PushState=Pushed;   
            PushFlag=1;
+           PushButton = ~PINB & 0x07;
         end
         else PushState=NoPush;
         break;
@@ -1757,29 +3549,54 @@ void init(){
   // USART in MSPIM mode, transmitter enabled, frequency fosc/4
   UCSR0B = _BV(TXEN0);
   UCSR0C = _BV(UMSEL01) | _BV(UMSEL00);
-  UBRR0  = 1 ;
+  UBRR0  = video_ubrr ;
+
+#ifdef SCREENSHOT
+  // USART1 8N1 at double speed, receiver for the request
+  UCSR1A = _BV(U2X1);
+  UBRR1  = shot_ubrr;
+  UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);
+  UCSR1B = _BV(RXEN1) | _BV(TXEN1);
+#endif
 
   // Setup ADC
-  ADMUX  = (1<<ADLAR) | (1<<REFS0); // read high byte and set Vref to Vcc
+  ADMUX  = adc_admux; // read high byte and set Vref to Vcc
   ADCSRA = (1 << ADEN) | (1<<ADSC) + 4; //enable ADC and set prescalar to 16
 
   adc_index = 0;
   adc_complete = 0;
   draw_complete = 1;
   running = 1;
+
+  //trigger: auto, rising edge through mid-scale, trigger point centred
+  trig_mode = TrigAuto;
+  trig_slope = TrigRising;
+  trig_level = 128;
+  trig_hyst = 4;
+  trig_pretrig = trace_length/2;
+  trig_timeout = 2*trace_length;
+
+  //raster sampling, 500 us/div
+  acq_mode = AcqNormal;
+  acq_deep = 0;
+  deep_zoom = deep_zmax;
+  avg_shift = 4;
+  timebase_set(1);
   
   //initialize synch constants 
   LineCount = 1;
 
+  //draw the static parts of the screen into page 0
+  draw_page = 0;
+  screen = scan_screen = screen_page[0];
+  flip_pending = 0;
+
   syncON  = 0b00000000;
   syncOFF = 0b00000001;
 
   //Print "CORNELL" message
   video_puts(30,2,cu1);
 
-  //Print "Copyright" message
-  video_putsmalls(screen_width-70,screen_height-10,cu2);
-
   //side lines
   #define width screen_width-1
   #define height screen_height-1
@@ -1789,7 +3606,21 @@ void init(){
   video_line(0,10,width,10,1);
   video_line(0,0,width,0,1);
   video_line(0,height,width,height,1);
+
+#ifdef GRATICULE
+  grat_init();
+#endif
+
+  //no trace on any page yet
+  memset(trace_lo, 255, sizeof(trace_lo));
+  memset(trace_hi, 0, sizeof(trace_hi));
  
+#ifdef DOUBLE_BUFFER
+  //both pages start with the same frame, draw into the back one
+  memcpy(screen_page[1], screen_page[0], screen_array_size);
+  draw_page = 1;
+  screen = screen_page[1];
+#endif
 
   ///////////////////////
 
@@ -1798,6 +3629,10 @@ void init(){
   //init the state machine
   PushState = NoPush;
 
+  view = ViewYT;
+  menu_item = MenuTime;
+  menu_draw();
+
   
   // Set up single video line timing
   sei();
@@ -1808,44 +3643,412 @@ void init(){
 
 //==================================         
 // set up the ports and timers
-int main() {
-  uint8_t j;
-  uint8_t temp;
+//==================================
+//frame-synchronous cooperative scheduler
+//from ScreenBot each frame every task is called, highest first, until
+//it returns 0 (done for this frame) or has used its budget, in which
+//case it is deferred to the next frame. A task that returns 1 is
+//called again straight away, so long jobs are cut into steps.
+//vblank tasks only run while no visible line is being sent
+//with nothing runnable the CPU sleeps until the next interrupt
+struct task {
+	char name[4];
+	uint8_t (*run)(void);	//returns 1 while it has more to do this frame
+	uint8_t vblank;
+	uint32_t budget;	//cycles a frame, 0 for no limit
+	uint32_t used;	//cycles used so far this frame
+	uint32_t last;	//cycles used in the previous frame
+	uint8_t ready;
+	uint8_t deferred;	//frames cut short by the budget
+};
 
-  init();
+uint8_t meas_pending;	//new readouts to draw
+
+//cycles since the start of line ScreenBot
+uint32_t sched_now(void) {
+	uint16_t t;
+	int l;
+
+	//no cli, so the raster runs on: if a line went by between the
+	//reads, read both again (under PROFILE the ISR reads TCNT1 too,
+	//which clobbers the latched high byte, but it is a line gone by)
+	do {
+		l = LineCount;
+		t = TCNT1;
+	} while (l != LineCount);
 
-  // The following loop executes the if-block
-  // when the screen refresh is done
-  // then does all of the frame-end processing
-  while(1) {
+	l -= ScreenBot;
+	if (l < 0) l += 262;
+	return (uint32_t)l * (LINE_TIME+1) + t;
+}
 
-	if (LineCount == ScreenBot) { 
+static inline uint8_t sched_vblank(void) {
+	return LineCount >= ScreenBot || LineCount < ScreenTop;
+}
 
-		if (adc_complete && running)
+#ifdef SCREENSHOT
+//==================================
+//screenshot: a host sends 'S' and gets back 'S','H', bytes_per_line,
+//screen_height, then the displayed page PackBits compressed
+//(n < 128: n+1 bytes follow as they are, n > 128: the next byte
+//257-n times)
+//the page is mostly black, but the trace and the side borders break
+//the runs on every row they cross: about 3100 of the 4000 bytes for
+//the default sine, 1500 for a spectrum
+//the GRATICULE overlay is ORed in at scanout and never stored, so
+//the capture has no grid and differs from the TV picture there
+prog_char shot_header[4] = {'S', 'H', bytes_per_line, screen_height};
+uint8_t shot_busy;	//rendering stops so the picture holds still
+uint8_t shot_head;	//header bytes sent
+uint16_t shot_pos;	//next screen byte to encode
+uint8_t shot_lit;	//literal bytes still to send
+uint8_t shot_rep;	//run length, its byte goes next
+
+//the next byte of the stream, the encoder works in place on the page
+uint8_t shot_byte(void) {
+	char *s = scan_screen + shot_pos;
+	uint16_t i, n;
+
+	if (shot_head < 4) return pgm_read_byte(&shot_header[shot_head++]);
+	if (shot_lit) {
+		shot_lit--;
+		shot_pos++;
+		return *s;
+	}
+	if (shot_rep) {
+		shot_pos += shot_rep;
+		shot_rep = 0;
+		return *s;
+	}
+
+	n = screen_array_size - shot_pos;
+	if (n > 128) n = 128;
+	for (i = 1; i < n && s[i] == s[0]; i++) ;
+	if (i > 1) {
+		shot_rep = i;
+		return 257 - i;
+	}
+	//a literal stops where the next run starts
+	for (i = 1; i < n && s[i] != s[i-1]; i++) ;
+	if (i < n) i--;
+	shot_lit = i;
+	return i - 1;
+}
+
+//polls USART1, so no new interrupt can delay the raster, and it
+//need not wait for vblank: the line ISR is still entered from the
+//COMPB sleep however busy the tasks are
+//about 190 bytes a frame at 115200 baud, so 16 frames for the
+//default screen
+uint8_t task_shot(void) {
+	if (UCSR1A & _BV(RXC1)) {
+		if (UDR1 == 'S' && !shot_busy) {
+			shot_busy = 1;
+			shot_head = 0;
+			shot_pos = 0;
+		}
+	}
+	if (!shot_busy) return 0;
+
+	while (UCSR1A & _BV(UDRE1)) {
+		UDR1 = shot_byte();
+		if (shot_pos == screen_array_size && !shot_lit && !shot_rep) {
+			shot_busy = 0;
+			return 0;
+		}
+	}
+	return 1;
+}
+#endif
+
+//task_render steps, each short enough for the RND budget
+#define RndIdle 0	//waiting for a capture
+#define RndAvg 1	//fold it into the average
+#define RndPlot 2	//XY, or set up the trace
+#define RndFFT 3	//one FFT stage a step, then the bars
+#define RndTrace 4	//channel 1
+#define RndTrace2 5	//channel 2
+#define RndShow 6	//readouts, hand the page to the ISR
+#define RndFlip 7	//draw into the other page once it is swapped in
+uint8_t rnd_step;
+uint8_t rnd_size;	//next FFT stage
+
+//collect and draw a finished capture (or the new roll columns)
+//in steps; adc_buffer is left alone until the last one
+uint8_t task_render(void) {
+#ifdef SCREENSHOT
+	if (shot_busy) return 0;
+#endif
+	switch (rnd_step) {
+	case RndIdle:
+		if (acq_source == AcqBurst && running && !acq_roll && trig_state < TrigDone)
+			acq_burst();
+
+		//roll mode draws as samples arrive, stopping just freezes it
+		if (acq_roll) {
+			if (running && roll_update()) meas_pending = 1;
+		}
+		//a stopped deep capture still finishes, so it can be browsed
+		else if (adc_complete && (running || acq_deep))
 		{
 			draw_complete = 0;
-			for (j = 0; j<160; j++){
-				temp = adc_erase[j] >> 1;
-				video_pt(j, -(screen_height+40) + temp, 2);
-				// add the 40 offset to make the hoirz line less noticeable
+			acq_collect();
+			//a single shot or a stopped capture is drawn as it is,
+			//averaging would leave it waiting for more captures
+			rnd_step = (trig_state == TrigHold) ? RndPlot : RndAvg;
+		}
+		//zoom or pan on a held deep record, no new capture needed;
+		//it is one record, so it is drawn as it is, not averaged
+		else if (deep_redraw && trig_state == TrigHold) {
+			draw_complete = 0;
+			deep_view();
+			rnd_step = RndPlot;
+		}
+		deep_redraw = 0;
+		return rnd_step != RndIdle;
+
+	case RndAvg:
+		if (!avg_update()) break;
+		rnd_step = RndPlot;
+		return 1;
+
+	case RndPlot:
+		if (view == ViewXY) {
+			trace_erase(0);
+			trace_erase(1);
+			xy_plot();
+			rnd_step = RndShow;
+		}
+		else if (view == ViewFFT) {
+			fft_load();
+			rnd_size = 2;
+			rnd_step = RndFFT;
+		}
+		else rnd_step = RndTrace;
+		return 1;
+
+	case RndFFT:
+		if (rnd_size && rnd_size <= fft_n) {
+			fft_stage(rnd_size);
+			rnd_size <<= 1;
+		}
+		else {
+			fft_bars();
+			rnd_step = RndTrace;
+		}
+		return 1;
+
+	case RndTrace:
+		//each page remembers its own trace, so with two
+		//pages this updates against the frame before last
+		trace_update(0, adc_min_buffer, adc_buffer);
+		rnd_step = RndTrace2;
+		return 1;
+
+	case RndTrace2:
+		if (acq_dual && view == ViewYT) trace_update(1, adc_buffer_b, adc_buffer_b);
+		else trace_erase(1);
+		rnd_step = RndShow;
+		return 1;
+
+	case RndShow:
+		meas_pending = 1;
+#ifdef DOUBLE_BUFFER
+		//RND only runs in blanking, so the ISR swaps on the next line
+		flip_pending = 1;
+		rnd_step = RndFlip;
+		return 1;
+
+	case RndFlip:
+		if (flip_pending) return 1;
+		draw_page ^= 1;
+		screen = screen_page[draw_page];
+#endif
+		break;
+	}
+	draw_complete = 1;
+	rnd_step = RndIdle;
+	return 0;
+}
+
+//readouts go to every page, so they need not wait for vblank
+uint8_t task_measure(void) {
+	if (meas_pending) {
+		meas_pending = 0;
+		meas_draw();
+	}
+	return 0;
+}
+
+//buttons are debounced at the frame rate
+//a press waits for a drawing in progress to finish, so the view
+//and the capture cannot change under it (PushFlag keeps it until
+//the button is let go, a few frames at least)
+uint8_t task_ui(void) {
+	check_button_state();
+	if (rnd_step == RndIdle) handle_input();
+	return 0;
+}
+
+#ifdef PROFILE
+uint8_t task_prof(void);
+#endif
+
+struct task tasks[] = {
+	{"RND", task_render, 1, 30000},
+	{"UI ", task_ui, 0, 10000},
+	{"MES", task_measure, 0, 30000},
+#ifdef PROFILE
+	{"PRF", task_prof, 0, 20000},
+#endif
+#ifdef SCREENSHOT
+	{"SER", task_shot, 0, 0},
+#endif
+};
+#define task_count (sizeof(tasks)/sizeof(tasks[0]))
+
+#ifdef PROFILE
+//per frame figures, taken when the frame turns over
+uint32_t prof_isr_frame, prof_idle_frame;
+uint32_t prof_isr_last;	//prof_isr_cycles at the last turnover
+uint16_t prof_last_collects;
+uint8_t prof_was_complete, prof_frames;
+
+void prof_frame(void) {
+	uint32_t c;
+	int l;
+
+	//the ISR adds to the sum every line; read it again if a line
+	//went by, and take the difference rather than clear it
+	do {
+		l = LineCount;
+		c = prof_isr_cycles;
+	} while (l != LineCount);
+	prof_isr_frame = c - prof_isr_last;
+	prof_isr_last = c;
+	prof_idle_frame = prof_idle;
+	prof_idle = 0;
+
+	//finished at the start of two frames with no collect between
+	if (adc_complete && running && prof_was_complete && prof_collects == prof_last_collects)
+		prof_dropped++;
+	prof_was_complete = adc_complete;
+	prof_last_collects = prof_collects;
+}
+
+//percent of a frame
+static inline uint8_t prof_pct(uint32_t c) {
+	return (c * 100) / frame_cycles;
+}
+
+//every 30 frames under the trace:
+//L worst visible line, B worst blank line (cycles at ISR exit),
+//D dropped frames, I raster ISR share, S main sleeping (slack)
+//and each task's share of the last frame
+#define ProfY (trace_top + trace_height + 1)
+uint8_t task_prof(void) {
+	char str[small_max + 8], *p;	//the first line may be clipped
+	uint8_t i;
+
+	if (++prof_frames < 30) return 0;
+	prof_frames = 0;
+
+	p = str;
+	*p++ = 'L';
+	p = fmt_num(p, prof_line_max, 5, 0);
+	*p++ = ' ';
+	*p++ = 'B';
+	p = fmt_num(p, prof_blank_max, 5, 0);
+	*p++ = ' ';
+	*p++ = 'D';
+	p = fmt_num(p, prof_dropped, 4, 0);
+	*p++ = ' ';
+	*p++ = 'I';
+	p = fmt_num(p, prof_pct(prof_isr_frame), 3, 0);
+	*p++ = '%';
+	*p++ = ' ';
+	*p++ = 'S';
+	p = fmt_num(p, prof_pct(prof_idle_frame), 3, 0);
+	*p++ = '%';
+	*p++ = ' ';
+	*p++ = 'A';
+	p = fmt_num(p, prof_burst_max, 3, 0);
+	*p = 0;
+	status_puts(4, ProfY, str);
+
+#if ProfY + 11 < MeasY
+	p = str;
+	//as many as fit across
+	for (i = 0; i < task_count && p + 9 <= str + small_max; i++) {
+		memcpy(p, tasks[i].name, 3);
+		p = fmt_num(p + 3, prof_pct(tasks[i].last), 3, 0);
+		*p++ = '%';
+		*p++ = ' ';
+	}
+	*p = 0;
+	status_puts(4, ProfY + 6, str);
+#endif
+
+	prof_line_max = 0;
+	prof_burst_max = 0;
+	prof_blank_max = 0;
+	return 0;
+}
+#endif
+
+void sched_run(void) {
+	uint8_t frame = frame_count, i;
+	uint32_t t;
+	struct task *k;
+
+	while (1) {
+		if (frame != frame_count) {
+			frame = frame_count;
+			for (i = 0; i < task_count; i++) {
+				tasks[i].last = tasks[i].used;
+				tasks[i].used = 0;
+				tasks[i].ready = 1;
 			}
-			
-			for (j = 0; j<160; j++){
-				temp = adc_buffer[j] >> 1;
-				video_pt(j, -(screen_height+40) + temp, 2);
-				// add the 40 offset to make the hoirz line less noticeable
+#ifdef PROFILE
+			prof_frame();
+#endif
+		}
+
+		//the first runnable task, then start over from the top
+		for (i = 0; i < task_count; i++) {
+			k = &tasks[i];
+			if (!k->ready || (k->vblank && !sched_vblank())) continue;
+
+			t = sched_now();
+			k->ready = k->run();
+			t = sched_now() - t;
+			if (t > frame_cycles) t += frame_cycles;	//ran past ScreenBot
+			k->used += t;
+
+			if (k->ready && k->budget && k->used >= k->budget) {
+				k->ready = 0;
+				k->deferred++;
 			}
-			
-			memcpy(adc_erase, adc_buffer, 160);
-			adc_complete = 0;
-			draw_complete = 1;
-		}	
-		
-		/////////////////////////////////////////
-		// add this line to execute code exactly once per frame
-		// comment it out for max execution speed
-		while (LineCount != ScreenTop) ;
-		//_delay_ms(1);
-     }  //line 231
-  }  //for
+			break;
+		}
+		if (i == task_count) {
+#ifdef PROFILE
+			t = sched_now();
+			sleep_cpu();
+			t = sched_now() - t;
+			if (t > frame_cycles) t += frame_cycles;
+			prof_idle += t;
+#else
+			sleep_cpu();
+#endif
+		}
+	}
+}
+
+int main() {
+
+  init();
+
+  //everything after init runs as a task, once a frame
+  sched_run();
 }  //main
@@ -0,0 +1,8 @@
+//host stand-in for <avr/interrupt.h>, see emu.c
+//handlers become plain functions the emulator calls
+#define ISR_NAKED
+#define ISR_NOBLOCK
+#define ISR(v, ...) void v(void)
+#define sei()
+#define cli()
+#define reti()
@@ -0,0 +1,86 @@
+//host stand-in for <avr/io.h>, see emu.c
+//plain registers are variables defined in emu.c, the ones the
+//emulator has to see are routed through functions
+#include <stdint.h>
+
+#define _BV(b) (1 << (b))
+
+#define EMU_REGS(R) \
+	R(PORTB) R(DDRB) R(PINB) R(PORTD) R(DDRD) \
+	R(UCSR0A) R(UCSR0B) R(UCSR0C) \
+	R(UCSR1B) R(UCSR1C) \
+	R(ADCL) R(ADMUX) R(ADCSRA) R(ADCSRB) R(DIDR0) \
+	R(TCCR0A) R(TCCR0B) R(OCR0A) R(TCNT0) R(TIMSK0) R(TIFR0) \
+	R(TCCR1A) R(TCCR1B) R(TIMSK1) R(TIFR1) \
+	R(TCCR2A) R(TCCR2B) R(OCR2A) R(TCNT2) R(TIMSK2) R(TIFR2) \
+	R(SMCR) R(MCUCR)
+#define EMU_REG_DECL(n) extern volatile uint8_t n;
+EMU_REGS(EMU_REG_DECL)
+extern volatile uint16_t OCR1A, OCR1B, UBRR0, UBRR1;
+
+//video bytes go to the raster image
+volatile uint8_t *emu_udr0(void);
+#define UDR0 (*emu_udr0())
+//a synthetic waveform at the current time on the ADMUX input
+volatile uint8_t *emu_adch(void);
+#define ADCH (*emu_adch())
+//cycles since the line interrupt
+volatile uint16_t *emu_tcnt1(void);
+#define TCNT1 (*emu_tcnt1())
+//USART1 talks to a pty or a file, polling it takes time
+volatile uint8_t *emu_ucsr1a(void);
+#define UCSR1A (*emu_ucsr1a())
+volatile uint8_t *emu_udr1(void);
+#define UDR1 (*emu_udr1())
+
+//USART
+#define UDRE0 5
+#define TXC0 6
+#define TXEN0 3
+#define UMSEL01 7
+#define UMSEL00 6
+#define UCPHA0 1
+#define UCPOL0 0
+#define RXC1 7
+#define TXC1 6
+#define UDRE1 5
+#define RXEN1 4
+#define TXEN1 3
+#define UCSZ11 2
+#define UCSZ10 1
+#define U2X1 1
+
+//ADC
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+
+//timers
+#define WGM01 1
+#define WGM12 3
+#define WGM21 1
+#define CS02 2
+#define CS01 1
+#define CS00 0
+#define CS10 0
+#define CS22 2
+#define CS21 1
+#define CS20 0
+#define OCIE0A 1
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCF0A 1
+#define OCF1A 1
+#define OCF1B 2
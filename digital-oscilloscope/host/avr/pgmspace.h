@@ -0,0 +1,10 @@
+//host stand-in for <avr/pgmspace.h>, flash is ordinary memory
+#include <stdint.h>
+
+#define PROGMEM
+typedef char prog_char;
+typedef uint8_t prog_uchar;
+typedef int16_t prog_int16_t;
+#define PSTR(s) (s)
+#define pgm_read_byte(a) (*(const uint8_t *)(uintptr_t)(a))
+#define pgm_read_word(a) (*(const uint16_t *)(uintptr_t)(a))
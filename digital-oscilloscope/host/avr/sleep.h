@@ -0,0 +1,8 @@
+//host stand-in for <avr/sleep.h>
+//sleeping is where the emulator runs the next line interrupt
+void emu_sleep(void);
+#define SLEEP_MODE_IDLE 0
+#define set_sleep_mode(m)
+#define sleep_enable()
+#define sleep_disable()
+#define sleep_cpu() emu_sleep()
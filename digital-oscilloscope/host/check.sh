@@ -0,0 +1,60 @@
+#!/bin/sh
+# Host checks for dig-osc.c, from any directory:
+#    ./check.sh       build everything here with -Werror, run trigtest
+#                     and ffttest, then run the emulator on each case
+#                     below and compare its raster with golden/<case>.pgm
+#    ./check.sh -u    write the golden images instead; look at them
+#                     before committing them
+# exit status 1 if anything fails
+
+cd "$(dirname "$0")" || exit 2
+cc=${CC:-cc}
+flags="-O2 -std=gnu99 -funsigned-char -Werror -I."
+out=${TMPDIR:-/tmp}/dig-osc-check
+update=0
+[ "$1" = -u ] && update=1
+mkdir -p "$out" golden
+fail=0
+
+for p in emu trigtest ffttest shot; do
+	$cc $flags -o "$out/$p" $p.c -lm || exit 1
+done
+
+if [ $update = 0 ]; then
+	for p in trigtest ffttest; do
+		if "$out/$p" > "$out/$p.log"; then echo "ok    $p"
+		else
+			cat "$out/$p.log"
+			fail=1
+		fi
+	done
+fi
+
+# case name, then the emulator options
+while read name opts; do
+	case $name in ''|'#'*) continue;; esac
+	if [ $update = 1 ]; then
+		"$out/emu" $opts -o "$out/$name" > /dev/null &&
+			cp "$out/$name-raster.pgm" golden/$name.pgm && echo "wrote golden/$name.pgm"
+	elif "$out/emu" $opts -o "$out/$name" -c golden/$name.pgm > "$out/$name.log"; then
+		echo "ok    $name"
+	else
+		echo "FAIL  $name: $(tail -1 "$out/$name.log"), see $out/$name-raster.pgm"
+		fail=1
+	fi
+done <<EOF
+yt       -n 30
+fft      -n 30 -v 1
+xy       -n 30 -v 2
+roll     -n 300 -v 3 -t 3 -1 square:60
+dual     -n 30 -d -2 square:300
+burst    -n 30 -t 0 -1 sine:5000
+peak     -n 90 -m 1 -t 6 -1 sine:2000
+# TRIG=NORM, EDGE=FALL
+trig     -n 70 -1 square:300 -k 5:1 -k 15:1 -k 25:2 -k 35:1 -k 45:4
+# AVG mode, stop, MEM=DEEP, then zoom in on the held record
+deep     -n 200 -m 2 -k 10:1 -k 20:4 -k 30:1 -k 40:1 -k 50:1 -k 60:1 -k 70:1 -k 80:1 -k 90:1 -k 100:1 -k 110:1 -k 120:1 -k 130:1 -k 140:2 -k 150:1 -k 160:2
+EOF
+
+[ $update = 0 ] && [ $fail = 0 ] && echo "all passed"
+exit $fail
@@ -0,0 +1,487 @@
+// Host emulator for dig-osc.c
+// Runs the unmodified firmware on Linux: the line interrupt is called
+// each time the firmware sleeps, ADCH returns a synthetic waveform at
+// the emulated time and the bytes written to UDR0 are collected into
+// the picture a TV would show. After the last frame screen[] and the
+// raster are written as PGM files. Only the raster has the graticule
+// overlay and, in roll mode, the rotated scanout.
+//
+// build (from this directory, any -D the firmware takes works here):
+//    cc -O2 -std=gnu99 -funsigned-char -I. -o emu emu.c -lm
+//
+// run:
+//    ./emu [-n frames] [-o prefix] [-1 wave] [-2 wave] [-t timebase]
+//          [-v view] [-m mode] [-d] [-k frame:buttons]... [-c golden.pgm]
+//          [-b iterations] [-r frame] [-u]
+//    wave is sine|square|tri|saw[:hz[:amplitude[:offset]]]
+//    -k holds PINB low with the button mask for a few frames
+//    -c compares the raster with a saved one, exit status 1 if it differs
+//       (check.sh runs the cases in golden/ this way)
+//    -b times the drawing primitives instead of running frames
+//    -r sends the screenshot request on USART1 at that frame, what
+//       comes back goes to prefix-usart1.bin (shot.c decodes it)
+//    -u puts USART1 on a pty instead and runs in real time, for
+//       shot -d /dev/pts/N
+//
+// Emulated time only advances with video bytes, delays and line
+// interrupts, so the tasks between lines take no time. The frame
+// budget figures under PROFILE are meaningless here.
+
+#define _GNU_SOURCE	//usleep, ptys
+#define main osc_main
+#include "../dig-osc.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <termios.h>
+
+//==================================
+//registers
+
+#define EMU_REG_DEF(n) volatile uint8_t n;
+EMU_REGS(EMU_REG_DEF)
+volatile uint16_t OCR1A, OCR1B, UBRR0, UBRR1;
+
+uint64_t emu_time;	//cycles since reset
+uint64_t emu_line_t;	//cycles at the last line interrupt
+uint64_t emu_burst_t;	//next timer 0 conversion of a burst
+
+//==================================
+//synthetic input
+
+#define WaveSine 0
+#define WaveSquare 1
+#define WaveTri 2
+#define WaveSaw 3
+char *wave_names[] = {"sine", "square", "tri", "saw"};
+
+struct wave {
+	uint8_t shape;
+	double hz;
+	double amp;	//ADC counts, peak
+	double offset;	//ADC counts
+};
+struct wave emu_wave[2] = {
+	{WaveSine, 1000, 100, 128},
+	{WaveTri, 250, 60, 128},
+};
+
+volatile uint8_t emu_adc;
+
+volatile uint8_t *emu_adch(void) {
+	struct wave *w = &emu_wave[ADMUX & 1];
+	double ph = w->hz * emu_time / F_CPU;
+	double v;
+
+	ph -= floor(ph);
+	switch (w->shape) {
+	case WaveSquare: v = ph < 0.5 ? 1 : -1; break;
+	case WaveTri: v = ph < 0.5 ? 4*ph - 1 : 3 - 4*ph; break;
+	case WaveSaw: v = 2*ph - 1; break;
+	default: v = sin(2*M_PI*ph);
+	}
+	v = w->offset + w->amp * v + 0.5;
+	emu_adc = v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+	return &emu_adc;
+}
+
+//==================================
+//video out
+
+#define raster_width (bytes_per_line*8)
+uint8_t raster[2][scan_lines][bytes_per_line];	//being drawn, last complete
+int raster_row, raster_col;
+volatile uint8_t emu_udr;
+
+volatile uint8_t *emu_udr0(void) {
+	//the byte before this one has gone by the time it is stored
+	if (raster_col > 0 && raster_col <= bytes_per_line)
+		raster[0][raster_row][raster_col - 1] = emu_udr;
+	raster_col++;
+	if (emu_time < emu_line_t + scan_start_cycles + raster_col*scan_cycles)
+		emu_time = emu_line_t + scan_start_cycles + raster_col*scan_cycles;
+	return &emu_udr;
+}
+
+volatile uint16_t emu_tcnt;
+uint8_t emu_in_isr;
+void emu_poll(int cycles);
+
+//with the line interrupt masked (a burst polls it for the sync) the
+//timer wraps on its own and a read takes a little time; outside the
+//ISR a read is a poll too, so a task waiting on the raster sees it
+volatile uint16_t *emu_tcnt1(void) {
+	uint64_t t;
+
+	if (!(TIMSK1 & _BV(OCIE1A))) {
+		emu_delay_us(0.25);
+		while (emu_time >= emu_line_t + LINE_TIME + 1) emu_line_t += LINE_TIME + 1;
+	}
+	else if (!emu_in_isr) emu_poll(4);
+	t = emu_time - emu_line_t;
+	emu_tcnt = t > LINE_TIME ? LINE_TIME : t;
+	return &emu_tcnt;
+}
+
+//==================================
+//timing
+
+uint16_t emu_prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+//bursts: timer 0 compare triggers a conversion, whose ISR runs at once
+void emu_delay_us(double us) {
+	uint64_t t = emu_time + (uint64_t)(us * (F_CPU / 1000000));
+	uint32_t period = (uint32_t)(OCR0A + 1) * emu_prescale[TCCR0B & 7];
+
+	if (period && (ADCSRA & _BV(ADATE)) && (ADCSRA & _BV(ADIE))) {
+		if (emu_burst_t + period < emu_time) emu_burst_t = emu_time + period;
+		for (; emu_burst_t <= t; emu_burst_t += period) {
+			emu_time = emu_burst_t;
+			ADC_vect();
+		}
+	}
+	emu_time = t;
+}
+
+//==================================
+//driver
+
+int emu_frames = 30;
+char *emu_prefix = "emu";
+char *emu_golden;
+long emu_bench;
+int opt_tb = -1, opt_view = -1, opt_mode = -1, opt_dual;
+
+#define key_max 32
+#define key_hold 6	//frames, enough for the debounce
+struct { int frame; uint8_t mask; } keys[key_max];
+int key_count;
+
+int frame;
+uint8_t emu_last_count;
+struct timespec emu_t0;
+uint64_t emu_t0_cycles;
+
+int emu_request = -1;	//frame to ask for a screenshot
+int emu_pty = -1;	//USART1 pty master
+FILE *emu_tx;	//USART1 output when there is no pty
+long emu_tx_bytes;
+int emu_rx = -1;	//received byte not yet read
+uint8_t emu_tx_pending;	//UDR1 was written
+uint64_t emu_tx_free;	//cycles when the transmitter is idle
+volatile uint8_t emu_u1a, emu_u1d;
+void emu_tx_flush(void);
+
+double now_us(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - emu_t0.tv_sec) * 1e6 + (t.tv_nsec - emu_t0.tv_nsec) / 1e3;
+}
+
+void pgm_write(char *name, int w, int h, uint8_t *bits, int stride) {
+	FILE *f = fopen(name, "wb");
+	int x, y;
+
+	if (!f) {
+		perror(name);
+		exit(2);
+	}
+	fprintf(f, "P5\n%d %d\n255\n", w, h);
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++)
+			fputc(((bits[y*stride + x/8] << (x & 7)) & 0x80) ? 255 : 0, f);
+	fclose(f);
+}
+
+//count of pixels that differ from a saved raster, -1 if unreadable
+long pgm_compare(char *name, int w, int h, uint8_t *bits, int stride) {
+	FILE *f = fopen(name, "rb");
+	int fw, fh, fmax, x, y, c;
+	long bad = 0;
+
+	if (!f) return -1;
+	if (fscanf(f, "P5 %d %d %d", &fw, &fh, &fmax) != 3 || fw != w || fh != h) {
+		fclose(f);
+		return -1;
+	}
+	fgetc(f);
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++) {
+			c = fgetc(f);
+			if (c < 0) {
+				fclose(f);
+				return -1;
+			}
+			if ((c >= 128) != !!((bits[y*stride + x/8] << (x & 7)) & 0x80)) bad++;
+		}
+	fclose(f);
+	return bad;
+}
+
+void emu_finish(void) {
+	char name[256];
+	double us = now_us();
+	long bad;
+
+	snprintf(name, sizeof name, "%s-screen.pgm", emu_prefix);
+	pgm_write(name, screen_width, screen_height, (uint8_t *)scan_screen, bytes_per_line);
+	snprintf(name, sizeof name, "%s-raster.pgm", emu_prefix);
+	pgm_write(name, raster_width, scan_lines, raster[1][0], bytes_per_line);
+	printf("%d frames, %.1f ms emulated, %.0f us host per frame\n",
+		frame, emu_time * 1e3 / F_CPU, us / frame);
+	emu_tx_flush();
+	if (emu_tx) {
+		fclose(emu_tx);
+		printf("%ld bytes out of USART1\n", emu_tx_bytes);
+	}
+
+	if (emu_golden) {
+		bad = pgm_compare(emu_golden, raster_width, scan_lines, raster[1][0], bytes_per_line);
+		if (bad) {
+			if (bad < 0) printf("%s: cannot compare\n", emu_golden);
+			else printf("%s: %ld pixels differ\n", emu_golden, bad);
+			exit(1);
+		}
+	}
+	exit(0);
+}
+
+//time the drawing primitives on the current screen
+void emu_bench_run(void) {
+	static uint8_t lo[2][trace_length], hi[2][trace_length];
+	long i, n = emu_bench;
+	int j;
+	double t;
+
+	srand(1);
+	t = now_us();
+	for (i = 0; i < n; i++)
+		video_line(rand() % screen_width, rand() % screen_height,
+			rand() % screen_width, rand() % screen_height, 2);
+	printf("video_line     %8.1f ns\n", (now_us() - t) * 1e3 / n);
+
+	t = now_us();
+	for (i = 0; i < n; i++)
+		video_putchar(rand() % (screen_width - 8), rand() % (screen_height - 8), 32 + rand() % 95);
+	printf("video_putchar  %8.1f ns\n", (now_us() - t) * 1e3 / n);
+
+	//two captures in turn, so every column changes
+	for (j = 0; j < trace_length; j++) {
+		lo[0][j] = hi[0][j] = 128 + 100 * sin(j / 8.0);
+		lo[1][j] = 128 + 60 * sin(j / 5.0) - 10;
+		hi[1][j] = lo[1][j] + 20;
+	}
+	t = now_us();
+	for (i = 0; i < n; i++)
+		trace_update(0, lo[i & 1], hi[i & 1]);
+	printf("trace_update   %8.1f ns\n", (now_us() - t) * 1e3 / n);
+	exit(0);
+}
+
+//settings from the command line, once init() is done
+void emu_start(void) {
+	int i;
+
+	PINB = 0x07;
+	if (opt_tb >= 0 && opt_tb < timebase_count) timebase_set(opt_tb);
+	if (opt_dual) acq_dual_set(1);
+	if (opt_mode >= 0 && opt_mode < mode_count) acq_mode_set(opt_mode);
+	//through the menu, so each view is set up as a user would
+	if (opt_view > 0) {
+		menu_item = MenuView;
+		for (i = 0; i < opt_view; i++) menu_change(1);
+		menu_item = 0;
+	}
+	menu_draw();
+	if (emu_bench) emu_bench_run();
+	clock_gettime(CLOCK_MONOTONIC, &emu_t0);
+	emu_t0_cycles = emu_time;
+}
+
+//the line interrupt, at emu_line_t
+void emu_line(void) {
+	static uint8_t started;
+	uint8_t pins = 0;
+	int i;
+
+	if (!started) {
+		started = 1;
+		emu_start();
+	}
+
+	raster_col = 0;
+	emu_in_isr = 1;
+	TIMER1_COMPA_vect();
+	emu_in_isr = 0;
+	if (raster_col) {
+		//the last byte out has no write after it
+		if (raster_col <= bytes_per_line)
+			raster[0][raster_row][raster_col - 1] = emu_udr;
+		if (raster_row < scan_lines - 1) raster_row++;
+	}
+
+	if (frame_count != emu_last_count) {
+		emu_last_count = frame_count;
+		memcpy(raster[1], raster[0], sizeof raster[0]);
+		memset(raster[0], 0, sizeof raster[0]);
+		raster_row = 0;
+		if (++frame >= emu_frames) emu_finish();
+
+		for (i = 0; i < key_count; i++)
+			if (frame >= keys[i].frame && frame < keys[i].frame + key_hold) pins |= keys[i].mask;
+		PINB = ~pins & 0x07;
+		if (frame == emu_request) emu_rx = 'S';
+
+		//in step with the clock when something is on the other end
+		if (emu_pty >= 0) {
+			i = (emu_time - emu_t0_cycles) * 1e6 / F_CPU - now_us();
+			if (i > 0) usleep(i);
+		}
+	}
+}
+
+//the firmware is idle until the next line interrupt
+void emu_sleep(void) {
+	//a burst stops the raster, which restarts when it is done
+	emu_line_t += LINE_TIME + 1;
+	if (emu_line_t < emu_time) emu_line_t = emu_time;
+	emu_time = emu_line_t;
+	if (TIMSK1 & _BV(OCIE1A)) emu_line();
+}
+
+//polled registers take time, so a line interrupt may come due
+void emu_poll(int cycles) {
+	emu_time += cycles;
+	if (!emu_in_isr && (TIMSK1 & _BV(OCIE1A)) && emu_time >= emu_line_t + LINE_TIME + 1) {
+		emu_line_t += LINE_TIME + 1;
+		emu_line();
+	}
+}
+
+//==================================
+//USART1
+
+#define usart1_cycles (10 * 8 * (UBRR1 + 1))	//8N1 at double speed
+
+//a write to UDR1 goes out at the next access to USART1
+void emu_tx_flush(void) {
+	char name[256];
+	uint8_t c = emu_u1d;
+
+	if (!emu_tx_pending) return;
+	emu_tx_pending = 0;
+	if (emu_pty >= 0) {
+		if (write(emu_pty, &c, 1) != 1) ;
+	}
+	else {
+		if (!emu_tx) {
+			snprintf(name, sizeof name, "%s-usart1.bin", emu_prefix);
+			emu_tx = fopen(name, "wb");
+			if (!emu_tx) {
+				perror(name);
+				exit(2);
+			}
+		}
+		fputc(c, emu_tx);
+	}
+	emu_tx_bytes++;
+	if (emu_tx_free < emu_time) emu_tx_free = emu_time;
+	emu_tx_free += usart1_cycles;
+}
+
+volatile uint8_t *emu_ucsr1a(void) {
+	uint8_t c;
+
+	emu_tx_flush();
+	emu_poll(4);
+	if (emu_rx < 0 && emu_pty >= 0 && read(emu_pty, &c, 1) == 1) emu_rx = c;
+
+	emu_u1a = UCSR1B ? _BV(U2X1) : 0;
+	if (emu_rx >= 0) emu_u1a |= _BV(RXC1);
+	//one byte shifting out and one in the buffer
+	if (emu_time + usart1_cycles >= emu_tx_free) emu_u1a |= _BV(UDRE1);
+	return &emu_u1a;
+}
+
+//a waiting received byte is read, anything else is a write
+volatile uint8_t *emu_udr1(void) {
+	emu_tx_flush();
+	if (emu_rx >= 0) {
+		emu_u1d = emu_rx;
+		emu_rx = -1;
+	}
+	else emu_tx_pending = 1;
+	return &emu_u1d;
+}
+
+void emu_pty_open(void) {
+	struct termios t;
+
+	emu_pty = posix_openpt(O_RDWR | O_NOCTTY);
+	if (emu_pty < 0 || grantpt(emu_pty) || unlockpt(emu_pty)) {
+		perror("pty");
+		exit(2);
+	}
+	tcgetattr(emu_pty, &t);
+	cfmakeraw(&t);
+	tcsetattr(emu_pty, TCSANOW, &t);
+	fcntl(emu_pty, F_SETFL, O_NONBLOCK);
+	printf("USART1 on %s\n", ptsname(emu_pty));
+	fflush(stdout);
+}
+
+int wave_parse(char *s, struct wave *w) {
+	char *p = strchr(s, ':');
+	int i, n = p ? p - s : strlen(s);
+
+	for (i = 0; i < 4; i++)
+		if (strlen(wave_names[i]) == n && !strncmp(s, wave_names[i], n)) break;
+	if (i == 4) return 0;
+	w->shape = i;
+	if (p) sscanf(p + 1, "%lf:%lf:%lf", &w->hz, &w->amp, &w->offset);
+	return 1;
+}
+
+int main(int argc, char **argv) {
+	int c;
+
+	while ((c = getopt(argc, argv, "n:o:1:2:t:v:m:dk:c:b:r:u")) != -1) {
+		switch (c) {
+		case 'n': emu_frames = atoi(optarg); break;
+		case 'o': emu_prefix = optarg; break;
+		case '1':
+		case '2':
+			if (!wave_parse(optarg, &emu_wave[c - '1'])) goto usage;
+			break;
+		case 't': opt_tb = atoi(optarg); break;
+		case 'v': opt_view = atoi(optarg); break;
+		case 'm': opt_mode = atoi(optarg); break;
+		case 'd': opt_dual = 1; break;
+		case 'k':
+			if (key_count == key_max) goto usage;
+			if (sscanf(optarg, "%d:%hhi", &keys[key_count].frame, &keys[key_count].mask) != 2) goto usage;
+			key_count++;
+			break;
+		case 'c': emu_golden = optarg; break;
+		case 'b': emu_bench = atol(optarg); break;
+		case 'r': emu_request = atoi(optarg); break;
+		case 'u': emu_pty_open(); break;
+		default: goto usage;
+		}
+	}
+	if (emu_frames < 1) goto usage;
+
+	osc_main();
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-n frames] [-o prefix] [-1 wave] [-2 wave] [-t timebase]\n"
+		"\t[-v view] [-m mode] [-d] [-k frame:buttons]... [-c golden.pgm] [-b iterations]\n"
+		"\t[-r frame] [-u]\n", argv[0]);
+	return 2;
+}
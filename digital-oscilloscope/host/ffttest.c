@@ -0,0 +1,159 @@
+// FFT test and benchmark for dig-osc.c
+// Runs the firmware's fixed-point transform (fft_load, fft_stage,
+// fft_bars) on synthetic captures and checks every bin against a
+// double-precision DFT of the same windowed input. The firmware halves
+// at each of the fft_log2n stages, so its bins are the DFT over fft_n.
+//
+// build and run (from this directory):
+//    cc -O2 -std=gnu99 -funsigned-char -I. -o ffttest ffttest.c -lm
+//    ./ffttest          check, exit status 1 if a bin is off
+//    ./ffttest -b n     also time n transforms (host time, not AVR cycles)
+
+#define main osc_main
+#include "../dig-osc.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "noemu.h"
+
+//most a bin may be off, in output counts: each stage truncates in
+//the halving and rounds the twiddle products (truncating those too
+//gave 6)
+#define fft_tolerance 3.5
+
+double ref_re[fft_n], ref_im[fft_n];
+int failed;
+
+double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+//==================================
+//captures, sample i of the trace
+
+double cycles, amp;	//across the fft_n samples, ADC counts peak
+
+int tone(int i) {
+	return 128 + amp * sin(2 * M_PI * cycles * (i - fft_first) / fft_n) + 0.5;
+}
+int square(int i) { return ((int)(2 * cycles * (i - fft_first) / fft_n) & 1) ? 255 : 0; }
+int noise(int i) { return rand() & 255; }
+
+//==================================
+
+//the DFT of exactly what fft_load hands the stages
+void reference(void) {
+	double x[fft_n], a;
+	int i, k;
+
+	for (i = 0; i < fft_n; i++)
+		x[i] = (((int)adc_buffer[fft_first+i] - 128) * fft_window[i]) >> 3;
+	for (k = 0; k < fft_n; k++) {
+		ref_re[k] = ref_im[k] = 0;
+		for (i = 0; i < fft_n; i++) {
+			a = -2 * M_PI * i * k / fft_n;
+			ref_re[k] += x[i] * cos(a);
+			ref_im[k] += x[i] * sin(a);
+		}
+		ref_re[k] /= fft_n;
+		ref_im[k] /= fft_n;
+	}
+}
+
+//bin with the tallest bar (the lowest top row) after fft_bars
+int tallest(void) {
+	int k, best = 0;
+
+	for (k = 1; k < fft_n/2; k++)
+		if (adc_min_buffer[2*k] < adc_min_buffer[2*best]) best = k;
+	return best;
+}
+
+//run the capture from f through the firmware and the reference
+void test(char *what, int (*f)(int), int peak) {
+	double e, worst = 0, sum = 0, big = 0;
+	int i, k;
+
+	for (i = 0; i < trace_length; i++) {
+		k = f(i);
+		adc_buffer[i] = k < 0 ? 0 : k > 255 ? 255 : k;
+	}
+	reference();
+	fft_run();
+
+	for (k = 0; k < fft_n; k++) {
+		e = hypot(fft_re[k] - ref_re[k], fft_im[k] - ref_im[k]);
+		if (e > worst) worst = e;
+		sum += e * e;
+		e = hypot(ref_re[k], ref_im[k]);
+		if (e > big) big = e;
+	}
+	fft_bars();
+
+	i = worst <= fft_tolerance && (peak < 0 || tallest() == peak);
+	printf("%s  %-22s largest bin %7.1f  error max %4.2f rms %4.2f",
+		i ? "ok  " : "FAIL", what, big, worst, sqrt(sum / fft_n));
+	if (peak >= 0) printf("  peak bin %d", tallest());
+	printf("\n");
+	if (!i) failed = 1;
+}
+
+void bench(long n) {
+	double t;
+	long i;
+	uint8_t size;
+
+	t = now_ns();
+	for (i = 0; i < n; i++) fft_load();
+	printf("fft_load   %8.1f ns\n", (now_ns() - t) / n);
+	t = now_ns();
+	for (i = 0; i < n; i++)
+		for (size = 2; size && size <= fft_n; size <<= 1) fft_stage(size);
+	printf("fft_stage  %8.1f ns each, %d of them\n", (now_ns() - t) / n / fft_log2n, fft_log2n);
+	t = now_ns();
+	for (i = 0; i < n; i++) fft_bars();
+	printf("fft_bars   %8.1f ns\n", (now_ns() - t) / n);
+	t = now_ns();
+	for (i = 0; i < n; i++) fft_run();
+	printf("fft_run    %8.1f ns\n", (now_ns() - t) / n);
+}
+
+int main(int argc, char **argv) {
+	long n = 0;
+
+	if (argc == 3 && !strcmp(argv[1], "-b")) n = atol(argv[2]);
+	else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-b iterations]\n", argv[0]);
+		return 2;
+	}
+
+	cycles = 0;
+	amp = 0;
+	test("silence", tone, -1);
+	cycles = 10;
+	amp = 100;
+	test("tone in bin 10", tone, 10);
+	cycles = 10.5;
+	test("tone between 10 and 11", tone, -1);
+	cycles = 1;
+	amp = 127;
+	test("full scale, bin 1", tone, 1);
+	cycles = 63;
+	test("full scale, bin 63", tone, 63);
+	cycles = 3;
+	amp = 3;
+	test("3 counts, bin 3", tone, 3);
+	cycles = 4;
+	test("full scale square", square, 4);
+	srand(1);
+	test("noise", noise, -1);
+
+	if (n) bench(n);
+	printf(failed ? "FAILED\n" : "all passed\n");
+	return failed;
+}
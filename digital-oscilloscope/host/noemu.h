@@ -0,0 +1,15 @@
+//register shims for host programs that run firmware code but no
+//video (trigtest.c, ffttest.c): nothing to emulate, they only link
+#define EMU_REG_DEF(n) volatile uint8_t n;
+EMU_REGS(EMU_REG_DEF)
+volatile uint16_t OCR1A, OCR1B, UBRR0, UBRR1;
+volatile uint8_t emu_reg;
+volatile uint16_t emu_reg16;
+
+volatile uint8_t *emu_udr0(void) { return &emu_reg; }
+volatile uint8_t *emu_adch(void) { return &emu_reg; }
+volatile uint16_t *emu_tcnt1(void) { return &emu_reg16; }
+volatile uint8_t *emu_ucsr1a(void) { return &emu_reg; }
+volatile uint8_t *emu_udr1(void) { return &emu_reg; }
+void emu_sleep(void) {}
+void emu_delay_us(double us) {}
@@ -0,0 +1,111 @@
+// Screenshot decoder for dig-osc.c (see task_shot)
+// Asks the scope for its screen over a serial port, or decodes a
+// stream saved earlier, and writes a PBM (pnmtopng makes a PNG).
+// The picture is the drawing page: the graticule the scope ORs in at
+// scanout is not in it.
+//
+// build:
+//    cc -O2 -o shot shot.c
+//
+// run:
+//    ./shot -d /dev/ttyUSB0 out.pbm      the board, USART1 at 115200
+//    ./shot -d /dev/pts/N out.pbm        emu -u
+//    ./shot out.pbm < emu-usart1.bin     emu -r frame
+
+#define _GNU_SOURCE	//cfmakeraw
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#define shot_timeout 30	//tenths of a second with nothing arriving
+
+int in = 0;
+long got;
+
+//the next byte, or exit if the stream stops
+uint8_t next(void) {
+	uint8_t c;
+
+	if (read(in, &c, 1) != 1) {
+		fprintf(stderr, "stream ended after %ld bytes\n", got);
+		exit(1);
+	}
+	got++;
+	return c;
+}
+
+void port_open(char *dev) {
+	struct termios t;
+
+	in = open(dev, O_RDWR | O_NOCTTY);
+	if (in < 0 || tcgetattr(in, &t)) {
+		perror(dev);
+		exit(2);
+	}
+	cfmakeraw(&t);
+	cfsetispeed(&t, B115200);
+	cfsetospeed(&t, B115200);
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = shot_timeout;
+	tcsetattr(in, TCSANOW, &t);
+	tcflush(in, TCIFLUSH);
+	if (write(in, "S", 1) != 1) {
+		perror(dev);
+		exit(2);
+	}
+}
+
+int main(int argc, char **argv) {
+	uint8_t *screen, *p;
+	int bpl, rows, size, n, c, i;
+	FILE *f;
+
+	while ((c = getopt(argc, argv, "d:")) != -1) {
+		if (c != 'd') goto usage;
+		port_open(optarg);
+	}
+	if (optind != argc - 1) goto usage;
+
+	//'S', 'H', bytes per line, rows
+	if (next() != 'S' || next() != 'H') {
+		fprintf(stderr, "not a screenshot\n");
+		return 1;
+	}
+	bpl = next();
+	rows = next();
+	size = bpl * rows;
+	screen = malloc(size);
+
+	//PackBits
+	for (p = screen; p < screen + size; ) {
+		n = next();
+		if (n < 128) {
+			for (n++; n > 0 && p < screen + size; n--) *p++ = next();
+		}
+		else if (n > 128) {
+			c = next();
+			for (n = 257 - n; n > 0 && p < screen + size; n--) *p++ = c;
+		}
+	}
+
+	f = fopen(argv[optind], "wb");
+	if (!f) {
+		perror(argv[optind]);
+		return 2;
+	}
+	//PBM is 1 for black, the scope 1 for white
+	fprintf(f, "P4\n%d %d\n", bpl * 8, rows);
+	for (i = 0; i < size; i++) fputc(~screen[i], f);
+	fclose(f);
+
+	printf("%dx%d, %ld bytes for %d (%d%%)\n", bpl * 8, rows, got, size, (int)(100 * got / size));
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-d device] out.pbm\n", argv[0]);
+	return 2;
+}
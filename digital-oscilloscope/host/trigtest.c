@@ -0,0 +1,166 @@
+// Trigger engine test for dig-osc.c
+// Feeds synthetic sample streams through acq_commit, the code the
+// raster ISR and ADC_vect run for every sample, and checks where each
+// trigger setting fires. The settings are changed through the menu,
+// as the buttons would. No video runs (see noemu.h).
+//
+// build and run (from this directory):
+//    cc -O2 -std=gnu99 -funsigned-char -I. -o trigtest trigtest.c -lm && ./trigtest
+// exit status 1 if any check fails
+
+#define main osc_main
+#include "../dig-osc.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "noemu.h"
+
+//==================================
+//streams, sample i
+
+int saw(long i) { return i & 255; }
+int flat(long i) { return 50; }
+//a square wave from 60 up to 133, just over the level, with every
+//8th sample of the high half dipping to 127, just under it; the
+//real rising edges are at 128, 256 ...
+int dip(long i) {
+	long k = i & 127;
+	if (k >= 64) return 60;
+	return ((k & 7) == 7) ? 127 : 133;
+}
+//noise either side of 104, inside 102..106
+int hover(long i) { return (i & 1) ? 106 : 102; }
+
+//==================================
+
+int failed;
+
+void check(int ok, char *what) {
+	printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+	if (!ok) failed = 1;
+}
+
+//feed up to n samples of f through the trigger, starting at sample
+//*at; returns the sample the trigger fired on, -1 if it did not
+//(the capture is then finished or n has run out)
+long feed(int (*f)(long), long *at, long n) {
+	long fired = -1, last = *at + n;
+	uint8_t s;
+
+	for (; *at < last && trig_state < TrigDone; (*at)++) {
+		s = f(*at);
+		acq_commit(s, s);
+		if (fired < 0 && trig_state == TrigPost) fired = *at;
+		//post-trigger samples: stop with the capture
+		if (trig_state == TrigDone) {
+			(*at)++;
+			break;
+		}
+	}
+	return fired;
+}
+
+//the fired sample sits at trace column trig_pretrig
+int at_pretrig(int v) {
+	return adc_ring[(uint8_t)(adc_start + trig_pretrig)] == v;
+}
+
+//set a menu item by pushing the value button dir, n times
+void push(uint8_t item, signed char dir, int n) {
+	menu_item = item;
+	while (n--) menu_change(dir);
+}
+
+//the factory trigger, then a short pre-trigger to keep streams short
+void reset(void) {
+	trig_mode = TrigAuto;
+	trig_slope = TrigRising;
+	trig_level = 128;
+	trig_hyst = 4;
+	trig_pretrig = 20;
+	running = 1;
+	trig_set();
+}
+
+int main(void) {
+	long t, at;
+
+	init();
+	printf("trace %d samples, pre-trigger 20\n", trace_length);
+
+	//rising edge through 104: armed below 100, fires on 104
+	reset();
+	push(MenuTrig, 1, 1);
+	push(MenuLevel, -1, 3);
+	at = 0;
+	t = feed(saw, &at, 1000);
+	check(trig_level == 104 && trig_mode == TrigNormal, "menu sets NORM, level 104");
+	check(t == 104 && at_pretrig(104), "rising saw fires at 104");
+	check(trig_state == TrigDone, "capture completes");
+	check(at == 104 + trace_length - trig_pretrig, "post-trigger length");
+
+	//falling edge on a rising saw: only the wrap to 0 crosses 104
+	push(MenuEdge, -1, 1);
+	at = 0;
+	t = feed(saw, &at, 1000);
+	check(trig_slope == TrigFalling && t == 256 && at_pretrig(0), "falling edge fires at the wrap");
+
+	//dips under the level: 4 codes of hysteresis ride through
+	//them and wait for the real edge
+	reset();
+	push(MenuTrig, 1, 1);
+	push(MenuEdge, 1, 1);
+	at = 0;
+	t = feed(dip, &at, 1000);
+	check(t == 128 && at_pretrig(133), "hysteresis 4: fires on the real edge");
+	push(MenuHyst, 1, 1);
+	check(trig_hyst == 8, "menu doubles the hysteresis");
+	push(MenuHyst, -1, 4);
+	check(trig_hyst == 0, "menu halves it to none");
+	at = 0;
+	t = feed(dip, &at, 1000);
+	check(t == 24, "no hysteresis: the first dip fires it");
+
+	//noise that never leaves the band never arms
+	reset();
+	push(MenuTrig, 1, 1);
+	trig_level = 104;
+	trig_set();
+	at = 0;
+	t = feed(hover, &at, 5000);
+	check(t < 0 && trig_state == TrigArmed, "normal: noise inside the band does not fire");
+	push(MenuHyst, -1, 3);
+	at = 0;
+	t = feed(hover, &at, 5000);
+	check(t == 21, "without hysteresis the same noise fires");
+
+	//no edges at all: auto fires after the timeout, normal never
+	reset();
+	at = 0;
+	t = feed(flat, &at, 5000);
+	check(t == 20 + trig_timeout && trig_forced, "auto: forced after the timeout");
+	push(MenuTrig, 1, 1);
+	at = 0;
+	t = feed(flat, &at, 5000);
+	check(t < 0 && !trig_forced && trig_state == TrigReady, "normal: flat input waits");
+
+	//single: hold after one capture, RUN up re-arms
+	reset();
+	push(MenuTrig, 1, 2);
+	check(trig_mode == TrigSingle, "menu sets SNGL");
+	at = 0;
+	feed(saw, &at, 1000);
+	acq_collect();
+	check(trig_state == TrigHold, "single holds after the capture");
+	t = feed(saw, &at, 1000);
+	check(t < 0 && trig_state == TrigHold, "a held single ignores the input");
+	push(MenuRun, 1, 1);
+	check(trig_state == TrigFill, "RUN re-arms the single shot");
+	at = 0;
+	t = feed(saw, &at, 1000);
+	check(t == 128 && at_pretrig(128), "and it fires again");
+
+	printf(failed ? "FAILED\n" : "all passed\n");
+	return failed;
+}
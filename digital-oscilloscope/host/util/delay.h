@@ -0,0 +1,5 @@
+//host stand-in for <util/delay.h>
+//delays advance emulated time, so burst captures still fill
+void emu_delay_us(double us);
+#define _delay_us(x) emu_delay_us(x)
+#define _delay_ms(x) emu_delay_us(1000.0 * (x))